@@ -0,0 +1,40 @@
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<std::uint64_t> allocation_count{0};
+
+void *allocate(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *pointer = std::malloc(size != 0 ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+}  // namespace
+
+namespace pubsub::benchmarks {
+
+std::uint64_t allocations() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+}  // namespace pubsub::benchmarks
+
+// The array and nothrow forms of the standard library call these
+void *operator new(std::size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
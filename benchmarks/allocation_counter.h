@@ -0,0 +1,15 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+namespace pubsub::benchmarks {
+
+// Calls to the global operator new in the whole process so far, every thread
+// and library included. The benchmark binary replaces operator new to count
+// them, take the difference over a run.
+std::uint64_t allocations();
+
+}  // namespace pubsub::benchmarks
+
+#endif // ALLOCATION_COUNTER_H
@@ -4,9 +4,12 @@
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/utility/setup/console.hpp>
 
+#include "allocation_counter.h"
 #include "pubsub_client.h"
 #include "pubsub_server.h"
 
+// Client side cost of a publish: it returns once the frame is buffered, see
+// end_to_end_benchmark.cpp for what subscribers actually receive
 static void BM_Publish(benchmark::State &state) {
     boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::error);
 
@@ -41,9 +44,12 @@ static void BM_Publish(benchmark::State &state) {
     client2.connect_socket("127.0.0.1", "12345");
     client2.connect("client2");
 
+    const auto allocations = pubsub::benchmarks::allocations();
     for (auto _ : state) {
         client2.publish("topic", "test_data");
     }
+    state.counters["allocs_per_op"] =
+        static_cast<double>(pubsub::benchmarks::allocations() - allocations) / static_cast<double>(state.iterations());
 
     client1.disconnect();
     client2.disconnect();
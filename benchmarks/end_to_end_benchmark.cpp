@@ -0,0 +1,404 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "allocation_counter.h"
+#include "io_backend.h"
+#include "latency_histogram.h"
+#include "pubsub_client.h"
+#include "pubsub_server.h"
+
+// End-to-end benchmarks: a real server and real clients over loopback TCP, or
+// the server's Unix domain socket or shared memory rings for BM_Transport.
+// Every iteration publishes a batch and waits until each subscriber received
+// all of it, so the rates reported are what subscribers got, not what the
+// publisher managed to enqueue. Payloads start with the send time, which gives
+// the p50/p99/p999 latency counters (in microseconds). allocs_per_msg counts
+// heap allocations anywhere in the process per delivered message.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using pubsub::benchmarks::LatencyHistogram;
+
+constexpr short kPort = 12346;
+// Timestamp at the front of every payload, hex encoded so it survives the text protocol too
+constexpr std::size_t kStampSize = 16;
+constexpr int kClientThreads = 4;
+// A batch is sized to stay well below the default outbound limits of a subscriber
+constexpr std::size_t kBatchBytes = 1024 * 1024;
+constexpr int kMaxBatch = 256;
+constexpr auto kDeliveryTimeout = std::chrono::seconds(10);
+
+enum class Transport { TCP, UNIX, SHM, SHM_SPIN };
+// How long both sides poll an idle ring with SHM_SPIN
+constexpr auto kShmSpin = std::chrono::microseconds(50);
+
+// Voluntary and involuntary context switches of the whole process so far
+std::int64_t context_switches() {
+    rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+std::uint64_t now_ns() {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+}
+
+// Overwrite the front of `payload` with the current time
+void stamp(std::string &payload) {
+    char digits[kStampSize + 1];
+    std::snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(now_ns()));
+    payload.replace(0, kStampSize, digits, kStampSize);
+}
+
+// Parsed in place, a copy would show up in allocs_per_msg
+std::uint64_t read_stamp(const std::string &payload) {
+    std::uint64_t sent{0};
+    if (payload.size() >= kStampSize) {
+        std::from_chars(payload.data(), payload.data() + kStampSize, sent, 16);
+    }
+    return sent;
+}
+
+// Clients log an error when the server closes them on teardown, keep that out of the report
+void silence_logging() {
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::fatal);
+}
+
+// Deliveries expected by the running iteration, shared by every subscriber
+class Delivery {
+public:
+    void expect(std::uint64_t messages) {
+        expected_.fetch_add(messages, std::memory_order_release);
+    }
+
+    void received(std::size_t bytes, std::uint64_t latency_ns) {
+        bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        latency_.record(latency_ns);
+        if (received_.fetch_add(1, std::memory_order_acq_rel) + 1 == expected_.load(std::memory_order_acquire)) {
+            std::lock_guard lock(mutex_);
+            done_.notify_one();
+        }
+    }
+
+    // False when the messages did not all arrive, e.g. because the server dropped some
+    bool wait() {
+        const auto deadline = Clock::now() + kDeliveryTimeout;
+        std::unique_lock lock(mutex_);
+        while (received_.load(std::memory_order_acquire) < expected_.load(std::memory_order_acquire)) {
+            if (Clock::now() >= deadline) {
+                return false;
+            }
+            done_.wait_for(lock, std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    std::uint64_t received_bytes() const {
+        return bytes_.load(std::memory_order_relaxed);
+    }
+
+    LatencyHistogram &latency() {
+        return latency_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::atomic<std::uint64_t> expected_{0};
+    std::atomic<std::uint64_t> received_{0};
+    std::atomic<std::uint64_t> bytes_{0};
+    LatencyHistogram latency_;
+};
+
+class Subscriber : public pubsub::client::PubSubClient {
+public:
+    Subscriber(boost::asio::io_context &io_context, Delivery &delivery)
+        : PubSubClient(io_context, pubsub::ProtocolVersion::BINARY), delivery_(delivery) {}
+
+protected:
+    void on_message_received(const std::string &, const std::string &message) override {
+        const auto sent = read_stamp(message);
+        const auto now = now_ns();
+        delivery_.received(message.size(), now > sent ? now - sent : 0);
+    }
+
+private:
+    Delivery &delivery_;
+};
+
+// Server thread, client threads and the publisher, torn down in reverse
+class Broker {
+public:
+    // With `compression` every client asks for it on CONNECT
+    explicit Broker(Transport transport = Transport::TCP, bool compression = false)
+        : transport_(transport),
+          compression_(compression),
+          server_(server_context_, kPort),
+          publisher_(publisher_context_, pubsub::ProtocolVersion::BINARY) {
+        if (transport_ != Transport::TCP) {
+            server_.listen_local(socket_path_);
+        }
+        if (transport_ == Transport::SHM_SPIN) {
+            server_.set_shared_memory_spin(kShmSpin);
+        }
+        threads_.emplace_back([this]() { server_context_.run(); });
+        threads_.emplace_back([this]() {
+            boost::asio::io_context::work work(publisher_context_);
+            publisher_context_.run();
+        });
+        for (auto &context : client_contexts_) {
+            threads_.emplace_back([&context]() {
+                boost::asio::io_context::work work(context);
+                context.run();
+            });
+        }
+
+        if (compression_) {
+            publisher_.enable_compression();
+        }
+        connect(publisher_);
+        publisher_.connect("publisher");
+    }
+
+    ~Broker() {
+        publisher_.disconnect();
+        for (auto &subscriber : subscribers_) {
+            subscriber->disconnect();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        server_context_.stop();
+        publisher_context_.stop();
+        for (auto &context : client_contexts_) {
+            context.stop();
+        }
+        for (auto &thread : threads_) {
+            thread.join();
+        }
+    }
+
+    // Subscribe a new client to every topic in `topics`
+    void add_subscriber(const std::vector<std::string> &topics) {
+        auto &context = client_contexts_[subscribers_.size() % client_contexts_.size()];
+        auto subscriber = std::make_unique<Subscriber>(context, delivery_);
+        if (compression_) {
+            subscriber->enable_compression();
+        }
+        connect(*subscriber);
+        subscriber->connect("subscriber" + std::to_string(subscribers_.size()));
+        for (const auto &topic : topics) {
+            subscriber->subscribe(topic);
+        }
+        subscribers_.push_back(std::move(subscriber));
+    }
+
+    // Give the subscriptions time to reach the server before publishing
+    void settle() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100 + subscribers_.size() / 5));
+    }
+
+    pubsub::client::PubSubClient &publisher() {
+        return publisher_;
+    }
+
+    Delivery &delivery() {
+        return delivery_;
+    }
+
+    // Bytes the server wrote to its clients so far
+    std::uint64_t server_bytes_out() {
+        return server_.stats().snapshot(server_.topic_manager()).bytes_out;
+    }
+
+private:
+    Transport transport_;
+    bool compression_;
+    std::string socket_path_ = "/tmp/pubsub_benchmark_" + std::to_string(::getpid()) + ".sock";
+    boost::asio::io_context server_context_;
+    boost::asio::io_context publisher_context_;
+    std::vector<boost::asio::io_context> client_contexts_ = std::vector<boost::asio::io_context>(kClientThreads);
+    pubsub::server::PubSubServer server_;
+    pubsub::client::PubSubClient publisher_;
+    Delivery delivery_;
+    std::vector<std::unique_ptr<Subscriber>> subscribers_;
+    std::vector<std::thread> threads_;
+
+    void connect(pubsub::client::PubSubClient &client) {
+        switch (transport_) {
+            case Transport::TCP:
+                client.connect_socket("127.0.0.1", std::to_string(kPort));
+                break;
+            case Transport::UNIX:
+                client.connect_local(socket_path_);
+                break;
+            case Transport::SHM:
+                client.connect_shared_memory(socket_path_);
+                break;
+            case Transport::SHM_SPIN:
+                client.connect_shared_memory(socket_path_, kShmSpin);
+                break;
+        }
+    }
+};
+
+// Publish batches round robin over `topics`, each delivered to `fan_out` subscribers
+void run(benchmark::State &state, Broker &broker, const std::vector<std::string> &topics, std::size_t payload_size,
+         int fan_out) {
+    payload_size = std::max(payload_size, kStampSize);
+    const int batch = static_cast<int>(std::clamp<std::size_t>(
+        kBatchBytes / (payload_size * static_cast<std::size_t>(fan_out)), 1, kMaxBatch));
+    // Repeated records like a JSON snapshot, so compression sees realistic redundancy
+    std::string payload;
+    for (std::size_t i = 0; payload.size() < payload_size; ++i) {
+        payload += R"({"symbol":"S)" + std::to_string(i % 1000) + R"(","bid":)" + std::to_string(i % 997) + "},";
+    }
+    payload.resize(payload_size);
+
+    broker.settle();
+
+    // Warm up, this also fails early when the subscriptions did not make it
+    std::size_t next_topic{0};
+    const auto publish_batch = [&]() {
+        broker.delivery().expect(static_cast<std::uint64_t>(batch) * fan_out);
+        for (int i = 0; i < batch; ++i) {
+            stamp(payload);
+            broker.publisher().publish(topics[next_topic], payload);
+            next_topic = (next_topic + 1) % topics.size();
+        }
+        return broker.delivery().wait();
+    };
+    if (!publish_batch()) {
+        state.SkipWithError("warm up messages were not delivered");
+        return;
+    }
+    const auto warm_up_bytes = broker.delivery().received_bytes();
+    broker.delivery().latency().reset();
+    const auto switches = context_switches();
+    const auto allocations = pubsub::benchmarks::allocations();
+    const auto bytes_out = broker.server_bytes_out();
+
+    for (auto _ : state) {
+        if (!publish_batch()) {
+            state.SkipWithError("messages were not delivered, see the slow consumer limits");
+            return;
+        }
+    }
+
+    const auto delivered = static_cast<std::int64_t>(state.iterations()) * batch * fan_out;
+    // Every wakeup of a thread waiting in the reactor is a context switch, a proxy for syscalls
+    state.counters["ctx_sw_per_msg"] =
+        static_cast<double>(context_switches() - switches) / static_cast<double>(std::max<std::int64_t>(delivered, 1));
+    // Server, publisher and subscribers all count, zero means no heap traffic on the message path
+    state.counters["allocs_per_msg"] = static_cast<double>(pubsub::benchmarks::allocations() - allocations) /
+                                       static_cast<double>(std::max<std::int64_t>(delivered, 1));
+    // What the subscribers' links carry, compressed frames included
+    state.counters["wire_bytes_per_msg"] = static_cast<double>(broker.server_bytes_out() - bytes_out) /
+                                           static_cast<double>(std::max<std::int64_t>(delivered, 1));
+    state.SetLabel(std::string(pubsub::kIoBackend));
+    state.SetItemsProcessed(delivered);
+    state.SetBytesProcessed(static_cast<std::int64_t>(broker.delivery().received_bytes() - warm_up_bytes));
+
+    const auto &latency = broker.delivery().latency();
+    state.counters["batch"] = batch;
+    state.counters["p50_us"] = static_cast<double>(latency.quantile(0.5)) / 1000.0;
+    state.counters["p99_us"] = static_cast<double>(latency.quantile(0.99)) / 1000.0;
+    state.counters["p999_us"] = static_cast<double>(latency.quantile(0.999)) / 1000.0;
+}
+
+// One topic with range(0) subscribers
+void BM_FanOut(benchmark::State &state) {
+    silence_logging();
+    Broker broker;
+    const std::vector<std::string> topics{"fan.out"};
+    const auto fan_out = static_cast<int>(state.range(0));
+    for (int i = 0; i < fan_out; ++i) {
+        broker.add_subscriber(topics);
+    }
+    run(state, broker, topics, 64, fan_out);
+}
+
+// One subscriber, payloads of range(0) bytes
+void BM_PayloadSize(benchmark::State &state) {
+    silence_logging();
+    Broker broker;
+    const std::vector<std::string> topics{"payload"};
+    broker.add_subscriber(topics);
+    run(state, broker, topics, static_cast<std::size_t>(state.range(0)), 1);
+}
+
+// One subscriber over loopback TCP (range(0) = 0), the Unix socket (1), shared memory (2) or shared
+// memory polled for kShmSpin before sleeping (3), payloads of range(1) bytes
+void BM_Transport(benchmark::State &state) {
+    silence_logging();
+    Broker broker(static_cast<Transport>(state.range(0)));
+    const std::vector<std::string> topics{"transport"};
+    broker.add_subscriber(topics);
+    run(state, broker, topics, static_cast<std::size_t>(state.range(1)), 1);
+}
+
+// 10 subscribers of large payloads of range(1) bytes, compressed for those
+// that accepted it when range(0) is 1
+void BM_Compression(benchmark::State &state) {
+    constexpr int kSubscribers = 10;
+
+    silence_logging();
+    Broker broker(Transport::TCP, state.range(0) != 0);
+    const std::vector<std::string> topics{"snapshot"};
+    for (int i = 0; i < kSubscribers; ++i) {
+        broker.add_subscriber(topics);
+    }
+    run(state, broker, topics, static_cast<std::size_t>(state.range(1)), kSubscribers);
+}
+
+// range(0) topics spread over 10 subscribers, published round robin
+void BM_ManyTopics(benchmark::State &state) {
+    constexpr int kSubscribers = 10;
+
+    silence_logging();
+    Broker broker;
+    std::vector<std::string> topics;
+    std::vector<std::vector<std::string>> per_subscriber(kSubscribers);
+    for (int i = 0; i < state.range(0); ++i) {
+        topics.push_back("many.topic" + std::to_string(i));
+        per_subscriber[i % kSubscribers].push_back(topics.back());
+    }
+    for (const auto &subscriptions : per_subscriber) {
+        broker.add_subscriber(subscriptions);
+    }
+    run(state, broker, topics, 64, 1);
+}
+
+}  // namespace
+
+BENCHMARK(BM_FanOut)->Arg(1)->Arg(10)->Arg(100)->Arg(1000)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_PayloadSize)->RangeMultiplier(16)->Range(16, 1 << 20)->UseRealTime()->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_Transport)
+    ->ArgNames({"transport", "payload"})
+    ->ArgsProduct({{0, 1, 2, 3}, {64, 4096, 65536}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_Compression)
+    ->ArgNames({"compression", "payload"})
+    ->ArgsProduct({{0, 1}, {64 * 1024, 512 * 1024}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ManyTopics)->Arg(10)->Arg(1000)->Arg(10000)->UseRealTime()->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,79 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+namespace pubsub::benchmarks {
+
+// Log-linear histogram of nanosecond latencies: every power of two is split
+// into kSubBuckets linear buckets, so quantiles are within ~3% of the sample.
+// Recording is a relaxed increment and safe from any thread.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 5;
+    static constexpr std::uint64_t kSubBuckets = 1u << kSubBucketBits;
+
+    void record(std::uint64_t nanoseconds) {
+        buckets_[index(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset() {
+        for (auto &bucket : buckets_) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::uint64_t count() const {
+        std::uint64_t total{0};
+        for (const auto &bucket : buckets_) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Upper bound of the bucket holding the `quantile` sample, 0 when empty
+    std::uint64_t quantile(double quantile) const {
+        const std::uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        const auto rank = static_cast<std::uint64_t>(quantile * static_cast<double>(total - 1)) + 1;
+        std::uint64_t seen{0};
+        for (std::size_t i = 0; i < buckets_.size(); ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return upper_bound(i);
+            }
+        }
+        return upper_bound(buckets_.size() - 1);
+    }
+
+private:
+    // Values below kSubBuckets get exact buckets, then 64 - kSubBucketBits octaves
+    std::array<std::atomic<std::uint64_t>, kSubBuckets * (65 - kSubBucketBits)> buckets_{};
+
+    static std::size_t index(std::uint64_t value) {
+        if (value < kSubBuckets) {
+            return value;
+        }
+        const int shift = std::bit_width(value) - 1 - kSubBucketBits;
+        const auto sub_bucket = (value >> shift) - kSubBuckets;
+        return static_cast<std::size_t>(shift + 1) * kSubBuckets + sub_bucket;
+    }
+
+    static std::uint64_t upper_bound(std::size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        const auto shift = index / kSubBuckets - 1;
+        const auto sub_bucket = index % kSubBuckets;
+        return ((kSubBuckets + sub_bucket + 1) << shift) - 1;
+    }
+};
+
+}  // namespace pubsub::benchmarks
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,144 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/log/trivial.hpp>
+#include <boost/log/utility/setup/common_attributes.hpp>
+#include <boost/log/utility/setup/console.hpp>
+
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "topic_manager.h"
+
+namespace {
+
+constexpr int kTopicsPerThread = 256;
+// One subscription change for every this many publishes
+constexpr int kPublishesPerChange = 16;
+
+// The routing table as it was before sharding: one map behind one mutex
+class LockedTopicMap {
+public:
+    void subscribe(std::string_view topic, std::shared_ptr<pubsub::Connection> connection) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        topics_[std::string(topic)].insert(connection);
+    }
+
+    void unsubscribe(std::string_view topic, std::shared_ptr<pubsub::Connection> connection) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = topics_.find(std::string(topic));
+        if (it != topics_.end()) {
+            it->second.erase(connection);
+            if (it->second.empty()) {
+                topics_.erase(it);
+            }
+        }
+    }
+
+    void unsubscribe_all(std::shared_ptr<pubsub::Connection> connection) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = topics_.begin(); it != topics_.end();) {
+            it->second.erase(connection);
+            it = it->second.empty() ? topics_.erase(it) : std::next(it);
+        }
+    }
+
+    void publish(std::string_view topic, std::string_view data) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = topics_.find(std::string(topic));
+        if (it == topics_.end()) {
+            return;
+        }
+
+        pubsub::MessageView msg{pubsub::MessageType::PUBLISH, topic, data};
+        const auto frame = pubsub::make_frame(msg, pubsub::ProtocolVersion::TEXT);
+        for (auto &connection : it->second) {
+            connection->send(frame);
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::set<std::shared_ptr<pubsub::Connection>>> topics_;
+};
+
+// Every thread publishes to its own topics with a little subscription churn.
+// Sends go to a closed connection owned by the publishing thread, so they are
+// dropped inline and the benchmark measures the routing table, not the network.
+template <typename Manager>
+void BM_PublishContention(benchmark::State &state) {
+    boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::error);
+
+    static Manager manager;
+
+    boost::asio::io_context io_context;
+    auto connection = std::make_shared<pubsub::Connection>(boost::asio::ip::tcp::socket(io_context));
+
+    std::vector<std::string> topics;
+    for (int i = 0; i < kTopicsPerThread; ++i) {
+        topics.push_back("thread" + std::to_string(state.thread_index()) + ".topic" + std::to_string(i));
+        manager.subscribe(topics.back(), connection);
+    }
+
+    // Run the loop inside io_context so the connection sees its owning thread
+    boost::asio::post(io_context, [&]() {
+        std::minstd_rand random(state.thread_index());
+        std::size_t iteration{0};
+        for (auto _ : state) {
+            const auto &topic = topics[random() % topics.size()];
+            if (++iteration % kPublishesPerChange == 0) {
+                manager.unsubscribe(topic, connection);
+                manager.subscribe(topic, connection);
+            } else {
+                manager.publish(topic, "test_data");
+            }
+        }
+    });
+    io_context.run();
+
+    manager.unsubscribe_all(connection);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Cost of disconnecting a client with a few subscriptions while the server
+// holds range(0) topics subscribed by other clients
+template <typename Manager>
+void BM_UnsubscribeAll(benchmark::State &state) {
+    constexpr int kOwnSubscriptions = 8;
+
+    boost::asio::io_context io_context;
+    auto others = std::make_shared<pubsub::Connection>(boost::asio::ip::tcp::socket(io_context));
+    auto leaving = std::make_shared<pubsub::Connection>(boost::asio::ip::tcp::socket(io_context));
+
+    Manager manager;
+    for (int i = 0; i < state.range(0); ++i) {
+        manager.subscribe("topic" + std::to_string(i), others);
+    }
+
+    std::vector<std::string> own_topics;
+    for (int i = 0; i < kOwnSubscriptions; ++i) {
+        own_topics.push_back("topic" + std::to_string(i * 7));
+    }
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (const auto &topic : own_topics) {
+            manager.subscribe(topic, leaving);
+        }
+        state.ResumeTiming();
+
+        manager.unsubscribe_all(leaving);
+    }
+
+    state.SetComplexityN(state.range(0));
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_UnsubscribeAll, LockedTopicMap)->RangeMultiplier(8)->Range(1 << 9, 200000)->Complexity();
+BENCHMARK_TEMPLATE(BM_UnsubscribeAll, pubsub::TopicManager)->RangeMultiplier(8)->Range(1 << 9, 200000)->Complexity();
+BENCHMARK_TEMPLATE(BM_PublishContention, LockedTopicMap)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PublishContention, pubsub::TopicManager)->ThreadRange(1, 16)->UseRealTime();
@@ -11,7 +11,9 @@ class Client {
 
 protected:
     virtual void on_message_received(const std::string& topic, const std::string& message) = 0;
-    virtual void write(const Message &message) = 0;
+    // Answer to a STATS request, space separated key=value pairs
+    virtual void on_stats_received(const std::string& stats) = 0;
+    virtual void write(const MessageView &message) = 0;
 };
 
 }  // namespace pubsub::client
@@ -0,0 +1,28 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace pubsub::compression {
+
+// Payloads from this size on are compressed for subscribers that accepted it
+constexpr std::size_t kDefaultThreshold{16 * 1024};
+// Largest payload a compressed one may expand to, anything claiming more is rejected
+constexpr std::size_t kMaxInflatedBytes{256 * 1024 * 1024};
+
+// Compressed payloads are the inflated size as 4 bytes in network byte order,
+// followed by a zlib stream.
+
+// Replace `out` with `data` compressed. False, and `out` empty, if that would
+// not make it any smaller.
+bool compress(std::string_view data, std::string &out);
+// Replace `out` with the payload `data` was compressed from. False if `data`
+// is corrupt, inflates to more than kMaxInflatedBytes or claims a size its
+// zlib stream is too short for.
+bool decompress(std::string_view data, std::string &out);
+
+}  // namespace pubsub::compression
+
+#endif // COMPRESSION_H
@@ -0,0 +1,128 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "frame_pool.h"
+#include "handler_memory.h"
+#include "message.h"
+#include "outbound_limits.h"
+#include "server_stats.h"
+#include "shm_channel.h"
+
+namespace pubsub {
+
+// Server side of a client connection. Owns the socket and an outbound queue
+// drained by a write coroutine, so writers only enqueue and never block. The
+// socket is only touched from the thread running its io_context, frames sent
+// from other threads are posted there.
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+    using FrameSPtr = pubsub::FrameSPtr;
+    // TCP or Unix domain stream socket, both convert to it
+    using Socket = boost::asio::generic::stream_protocol::socket;
+
+    // The socket must use an io_context executor, its thread owns the connection.
+    // Writes and the queue are counted in `traffic` when given, which must belong to that thread.
+    explicit Connection(Socket socket, std::shared_ptr<TrafficCounters> traffic = nullptr);
+
+    Socket &socket();
+    bool is_open() const;
+    // Remote address and port, or unix:<path> of the listening socket. Empty
+    // if the socket was not connected.
+    const std::string &peer() const;
+
+    // Wire protocol negotiated on CONNECT, used for both directions
+    ProtocolVersion protocol() const;
+    void set_protocol(ProtocolVersion protocol);
+    // The client accepted PUBLISH frames with compressed data on CONNECT
+    bool compression() const;
+    void set_compression(bool enabled);
+
+    // Queue a serialized frame for delivery to the client, safe from any thread
+    void send(FrameSPtr frame);
+    // Same, applying `limits` when the queue is over its high-water mark. The
+    // policy that fired is counted in `counters`, which must outlive the call.
+    void send(FrameSPtr frame, const OutboundLimits &limits, SlowConsumerCounters &counters);
+
+    // Topic aliases the client defined on this connection, mapped to interned
+    // topic ids. Only used from the thread owning the connection.
+    void set_topic_alias(std::uint32_t alias, std::uint32_t topic_id);
+    bool topic_alias(std::uint32_t alias, std::uint32_t &topic_id) const;
+    // Forget every alias, returning the topic ids they stood for
+    std::vector<std::uint32_t> clear_topic_aliases();
+
+    // Number of frames queued or being written, safe from any thread
+    std::size_t queue_depth() const;
+    // Bytes queued or being written, safe from any thread
+    std::size_t queued_bytes() const;
+
+    // Run `callback` on the owning thread once every queued frame is written,
+    // right away if none are. Replaces an earlier callback, which close()
+    // drops unrun. Only used from the thread owning the connection.
+    void on_drained(std::function<void()> callback);
+
+    // Shutdown and close the socket, dropping pending frames
+    void close();
+
+    // Write frames to the client through `channel` from now on, the socket only
+    // carries doorbells. False if frames were already sent over the socket or
+    // a channel is attached.
+    bool attach(std::unique_ptr<ShmChannel> channel);
+    // Shared memory channel of a local client, null for socket clients
+    ShmChannel *channel() const;
+    // Frames waiting for room in the shared memory ring
+    bool write_pending() const;
+    // Retry writing to the ring after the client made room
+    void resume();
+
+private:
+    Socket socket_;
+    boost::asio::io_context::executor_type owner_;
+    std::shared_ptr<TrafficCounters> traffic_;
+    std::string peer_;
+    // Read by publishers on other threads
+    std::atomic<ProtocolVersion> protocol_{ProtocolVersion::TEXT};
+    std::atomic<bool> compression_{false};
+    std::deque<FrameSPtr> outbound_;
+    std::vector<boost::asio::const_buffer> write_buffers_;
+    std::size_t in_flight_{0};
+    // Start of the write in progress, only set while timing is on
+    std::chrono::steady_clock::time_point write_started_;
+    // Mirror the outbound queue for readers on other threads, only the owner writes them
+    std::atomic<std::size_t> queued_frames_{0};
+    std::atomic<std::size_t> queued_bytes_{0};
+    // Indexed by alias, kNoTopicAlias marks unused entries
+    std::vector<std::uint32_t> topic_aliases_;
+    std::unique_ptr<ShmChannel> channel_;
+    // Bytes of the front frame already in the ring
+    std::size_t front_written_{0};
+    // Frames posted from other threads, one post at a time in steady state
+    HandlerMemory send_memory_;
+    // Wakes the idle write loop, which runs from the first frame until close()
+    boost::asio::steady_timer wake_;
+    bool writer_started_{false};
+    std::function<void()> drained_;
+
+    void enqueue(FrameSPtr frame);
+    void enqueue_limited(FrameSPtr frame, const OutboundLimits &limits, SlowConsumerCounters &counters);
+    // Erase queued frames, keeping the queue counters in step
+    void drop_queued(std::deque<FrameSPtr>::iterator first, std::deque<FrameSPtr>::iterator last);
+    // Gather the queue into write_buffers_ for the write loop
+    void start_write();
+    boost::asio::awaitable<void> write_loop(std::shared_ptr<Connection> keep_alive);
+    void write_ring();
+    // Post drained_ once the queue is empty
+    void notify_drained();
+    void handle_write(const boost::system::error_code &error, std::size_t bytes_transferred);
+};
+
+}  // namespace pubsub
+
+#endif // CONNECTION_H
@@ -0,0 +1,26 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include "message.h"
+
+namespace pubsub {
+
+// Encoded frame, immutable so one copy can be shared by every subscriber
+using Frame = std::pmr::string;
+using FrameSPtr = std::shared_ptr<const Frame>;
+
+// Encode `message` for `protocol` into a frame from the frame pool. The frame
+// and its reference count come from a pooled freelist shared by all threads,
+// and go back to it when the last connection is done writing it, so a steady
+// stream of small messages does not reach the heap. Frames larger than
+// kMaxPooledFrameBytes are allocated and freed individually.
+FrameSPtr make_frame(const MessageView &message, ProtocolVersion protocol);
+
+constexpr std::size_t kMaxPooledFrameBytes{64 * 1024};
+
+}  // namespace pubsub
+
+#endif // FRAME_POOL_H
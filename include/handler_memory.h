@@ -0,0 +1,94 @@
+#ifndef HANDLER_MEMORY_H
+#define HANDLER_MEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace pubsub {
+
+// Storage for one completion handler at a time, handed out again as soon as
+// the operation using it completes. A handler that does not fit, or comes
+// while the block is taken, goes to the heap. The block may be taken on one
+// thread and given back on another, like a post from a publisher thread that
+// completes on the io_context of the connection.
+class HandlerMemory {
+public:
+    static constexpr std::size_t kSize{256};
+
+    HandlerMemory() = default;
+    HandlerMemory(const HandlerMemory &) = delete;
+    HandlerMemory &operator=(const HandlerMemory &) = delete;
+
+    void *allocate(std::size_t size);
+    void deallocate(void *pointer);
+
+private:
+    alignas(std::max_align_t) unsigned char storage_[kSize];
+    std::atomic<bool> in_use_{false};
+};
+
+// Standard allocator over a HandlerMemory, which must outlive the operations
+// allocating from it
+template <typename T>
+class HandlerAllocator {
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory &memory) noexcept : memory_(&memory) {}
+
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U> &other) noexcept : memory_(other.memory_) {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(memory_->allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T *pointer, std::size_t) {
+        memory_->deallocate(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const HandlerAllocator<U> &other) const noexcept {
+        return memory_ == other.memory_;
+    }
+
+private:
+    template <typename>
+    friend class HandlerAllocator;
+
+    HandlerMemory *memory_;
+};
+
+// Completion handler whose operations allocate from a HandlerMemory, Asio finds
+// it as the handler's associated allocator
+template <typename Handler>
+class MemoryHandler {
+public:
+    using allocator_type = HandlerAllocator<Handler>;
+
+    MemoryHandler(HandlerMemory &memory, Handler handler) : memory_(memory), handler_(std::move(handler)) {}
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type(memory_);
+    }
+
+    template <typename... Args>
+    void operator()(Args &&...args) {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    HandlerMemory &memory_;
+    Handler handler_;
+};
+
+template <typename Handler>
+MemoryHandler<std::decay_t<Handler>> bind_memory(HandlerMemory &memory, Handler &&handler) {
+    return MemoryHandler<std::decay_t<Handler>>(memory, std::forward<Handler>(handler));
+}
+
+}  // namespace pubsub
+
+#endif // HANDLER_MEMORY_H
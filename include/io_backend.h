@@ -0,0 +1,18 @@
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include <boost/asio.hpp>
+#include <string_view>
+
+namespace pubsub {
+
+// Asio backend the sockets run on, chosen with the PUBSUB_USE_IO_URING CMake option
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+constexpr std::string_view kIoBackend{"io_uring"};
+#else
+constexpr std::string_view kIoBackend{"epoll"};
+#endif
+
+}  // namespace pubsub
+
+#endif // IO_BACKEND_H
@@ -0,0 +1,48 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <boost/log/trivial.hpp>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+// Lowest severity compiled into the binaries, set by the PUBSUB_LOG_LEVEL CMake option
+#ifndef PUBSUB_MIN_LOG_SEVERITY
+#define PUBSUB_MIN_LOG_SEVERITY debug
+#endif
+
+namespace pubsub::logging {
+
+constexpr bool compiled_in(boost::log::trivial::severity_level severity) {
+    return severity >= boost::log::trivial::PUBSUB_MIN_LOG_SEVERITY;
+}
+
+// Records accepted per second before the rest are dropped and counted
+constexpr std::size_t kDefaultMaxRecordsPerSecond{1000};
+
+// Console logging through a background thread, so a record costs the caller a
+// queue push instead of a write to the terminal. Records below `level` are
+// filtered out. Past `max_records_per_second` records are dropped, the next
+// record that gets through tells how many were.
+void init(boost::log::trivial::severity_level level,
+          std::size_t max_records_per_second = kDefaultMaxRecordsPerSecond);
+
+// "trace", "debug", "info", "warning", "error" or "fatal"
+std::optional<boost::log::trivial::severity_level> parse_level(std::string_view name);
+
+// Write out the queued records and stop the background thread, also run at exit
+void shutdown();
+
+}  // namespace pubsub::logging
+
+// Same as BOOST_LOG_TRIVIAL, but records below PUBSUB_MIN_LOG_SEVERITY are
+// removed at compile time, arguments included. For logs on the message path.
+// The switch makes it one statement, an else after it can not bind inside.
+#define PUBSUB_LOG(severity)                                                               \
+    switch (0)                                                                             \
+    default:                                                                               \
+        if constexpr (!::pubsub::logging::compiled_in(::boost::log::trivial::severity)) { \
+        } else                                                                             \
+            BOOST_LOG_TRIVIAL(severity)
+
+#endif // LOGGING_H
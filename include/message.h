@@ -1,7 +1,11 @@
 #ifndef MESSAGE_H
 #define MESSAGE_H
 
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 
 namespace pubsub {
 
@@ -12,28 +16,114 @@ enum class MessageType {
     PUBLISH,
     SUBSCRIBE,
     UNSUBSCRIBE,
+    CONNACK,
+    STATS,  // request from a client, the server answers with its counters in data
+    SHM,    // first frame of a local client, moving the connection to shared memory rings of data bytes each
     UNKNOWN
 };
 
+// Wire protocol versions. Every connection starts in TEXT, a client asks for
+// another version in its CONNECT and both sides switch right after the
+// handshake frames (CONNECT and CONNACK are always sent as text).
+enum class ProtocolVersion : std::uint8_t {
+    TEXT = 1,    // newline delimited, used by the console client
+    BINARY = 2,  // length prefixed, binary safe payloads
+};
+
+// Binary protocol only: no topic alias on the frame
+constexpr std::uint32_t kNoTopicAlias{UINT32_MAX};
+// No log offset on the frame
+constexpr std::uint64_t kNoOffset{UINT64_MAX};
+
+// Non-owning view of a message. Parsing never allocates, topic and data point
+// into the parsed buffer and are only valid as long as that buffer is.
+struct MessageView {
+    MessageType type{MessageType::UNKNOWN};
+    std::string_view topic;
+    std::string_view data;
+    ProtocolVersion version{ProtocolVersion::TEXT};
+    // Per connection topic alias of a binary PUBLISH. Sent with a topic it
+    // defines the alias, sent with an empty topic it stands for that topic.
+    std::uint32_t alias{kNoTopicAlias};
+    // Log offset of a PUBLISH from a durable topic (binary protocol only), or
+    // the offset a SUBSCRIBE replays the topic's log from
+    std::uint64_t offset{kNoOffset};
+    // Optional features requested (CONNECT) or accepted (CONNACK), Message::kCapability* bits
+    std::uint8_t capabilities{0};
+    // Data of a binary PUBLISH is compressed, see compression.h
+    bool compressed{false};
+
+    // Serialize the message into a string
+    std::string serialize(ProtocolVersion protocol = ProtocolVersion::TEXT) const;
+    // Append the encoded frame to `out`, allocating only if it runs out of capacity
+    void serialize_to(std::string &out, ProtocolVersion protocol) const;
+    void serialize_to(std::pmr::string &out, ProtocolVersion protocol) const;
+    // Parse a single frame as returned by Message::next_frame
+    static MessageView parse(std::string_view frame, ProtocolVersion protocol = ProtocolVersion::TEXT);
+};
+
 // Message structure
 struct Message {
     MessageType type;
     std::string topic;
     std::string data;
+    // Requested (CONNECT) or accepted (CONNACK) protocol version
+    ProtocolVersion version{ProtocolVersion::TEXT};
+    // See MessageView
+    std::uint32_t alias{kNoTopicAlias};
+    std::uint64_t offset{kNoOffset};
+    std::uint8_t capabilities{0};
+    bool compressed{false};
+
+    // View of this message, valid while the message is alive and unchanged
+    MessageView view() const;
 
     // Serialize the message into a string
-    std::string serialize() const;
+    std::string serialize(ProtocolVersion protocol = ProtocolVersion::TEXT) const;
     // Deserialize a string into a Message object
-    static Message deserialize(const std::string& message);
+    static Message deserialize(std::string_view message, ProtocolVersion protocol = ProtocolVersion::TEXT);
+
+    // Find the first complete frame at the start of `buffer`. Returns the number of
+    // bytes it occupies, 0 if it is incomplete, or kFrameTooLarge once it is
+    // known to exceed kMaxFrameSize. `frame` is set to the text line without
+    // delimiter, or to the whole binary frame including its header.
+    static std::size_t next_frame(std::string_view buffer, ProtocolVersion protocol, std::string_view &frame);
 
     static constexpr std::string kConnectCommand{"CONNECT"};
+    static constexpr std::string kConnackCommand{"CONNACK"};
     static constexpr std::string kDisconnectCommand{"DISCONNECT"};
     static constexpr std::string kPublishCommand{"PUBLISH"};
     static constexpr std::string kSubscribeCommand{"SUBSCRIBE"};
     static constexpr std::string kUnsubscribeCommand{"UNSUBSCRIBE"};
+    static constexpr std::string kStatsCommand{"STATS"};
+    static constexpr std::string kShmCommand{"SHM"};
     static constexpr std::string kHelpCommand{"HELP"};
     static constexpr std::string kUnknowndCommand{"UNKNOWN"};
     static constexpr std::string kDelim{"\n"};
+    // Capabilities follow the version of a text CONNECT or CONNACK, by name
+    static constexpr std::string kCompressCapability{"compress"};
+
+    // Binary header: type (1), flags (1), topic length (2), data length (4),
+    // all in network byte order, followed by the topic and the data
+    static constexpr std::size_t kBinaryHeaderSize{8};
+    // Flag: the topic field starts with a 4 byte topic alias
+    static constexpr std::uint8_t kFlagTopicAlias{0x01};
+    // Flag: the topic field continues with an 8 byte log offset
+    static constexpr std::uint8_t kFlagOffset{0x02};
+    // Flag: the data is compressed
+    static constexpr std::uint8_t kFlagCompressed{0x04};
+    // Capability: the client takes PUBLISH frames with compressed data, binary protocol only
+    static constexpr std::uint8_t kCapabilityCompression{0x01};
+    // Longest topic name, leaving room for an alias and an offset in the 16 bit topic field
+    static constexpr std::size_t kMaxTopicSize{UINT16_MAX - 4 - 8};
+    // Largest alias a client may define on one connection
+    static constexpr std::uint32_t kMaxTopicAlias{65535};
+    // Largest data a frame may carry, and the largest frame. The peer is not
+    // buffered beyond it, a connection sending more is closed.
+    static constexpr std::size_t kMaxDataSize{256 * 1024 * 1024};
+    static constexpr std::size_t kMaxFrameSize{kBinaryHeaderSize + UINT16_MAX + kMaxDataSize};
+    // Returned by next_frame() for a frame over kMaxFrameSize
+    static constexpr std::size_t kFrameTooLarge{SIZE_MAX};
 };
 
 }  // namespace pubsub
@@ -0,0 +1,190 @@
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace pubsub {
+
+// When the log writer makes appended messages durable
+enum class FsyncPolicy : std::uint8_t {
+    NEVER,     // leave it to the kernel
+    BATCH,     // group commit, once per batch of appends the writer picked up
+    INTERVAL,  // at most once per fsync interval
+};
+
+// Parse the command line spelling: never, batch or interval
+std::optional<FsyncPolicy> parse_fsync_policy(std::string_view name);
+
+class MessageLog;
+class LogCursor;
+
+// Append-only log of one topic, split into segment files named after the
+// offset of their first record. Every record is its offset (8), its size (4),
+// both in network byte order, followed by the payload.
+class TopicLog {
+public:
+    using ReadCallback = std::function<void(std::uint64_t offset, std::string_view data)>;
+    using WrittenCallback = std::function<void()>;
+
+    TopicLog(MessageLog &owner, std::filesystem::path directory);
+    ~TopicLog();
+
+    TopicLog(const TopicLog &) = delete;
+    TopicLog &operator=(const TopicLog &) = delete;
+
+    // Assign the next offset and hand the record to the writer thread, never
+    // waits for the disk. Safe from any thread.
+    std::uint64_t append(std::string_view data);
+
+    // Offset the next append gets
+    std::uint64_t next_offset() const;
+
+    // Run `callback` once every record before `offset` is in the segment
+    // files: right away if they are, otherwise on the writer thread
+    void when_written(std::uint64_t offset, WrittenCallback callback);
+
+    // Call `callback` for the records in [from, to) that are written, in order.
+    // `data` is only valid during the call.
+    void read(std::uint64_t from, std::uint64_t to, const ReadCallback &callback) const;
+
+private:
+    friend class MessageLog;
+    friend class LogCursor;
+
+    struct Segment {
+        std::uint64_t base_offset;
+        std::filesystem::path path;
+    };
+
+    MessageLog &owner_;
+    std::filesystem::path directory_;
+
+    // Guarded by the owner's queue mutex, so offsets are queued in order
+    std::uint64_t next_offset_{0};
+
+    // Guarded by written_mutex_
+    mutable std::mutex written_mutex_;
+    std::uint64_t written_offset_{0};
+    std::vector<Segment> segments_;
+    // when_written() callbacks with the offset they wait for
+    std::vector<std::pair<std::uint64_t, WrittenCallback>> waiters_;
+
+    // Only used by the writer thread
+    int fd_{-1};
+    std::uint64_t segment_size_{0};
+    bool dirty_{false};
+
+    // Scan the existing segments, drop a torn record at the end of the last one
+    void recover();
+    void open_segment(std::uint64_t base_offset);
+    // Writer thread: append the encoded records [first_offset, end_offset)
+    void write_records(const std::string &records, std::uint64_t first_offset, std::uint64_t end_offset);
+    // Writer thread: let readers see everything before `end_offset`
+    void mark_written(std::uint64_t end_offset);
+    void sync();
+};
+
+// Sequential reader of a topic log. Each read continues at the file position
+// the previous one stopped at, so reading a log in chunks costs no more than
+// reading it at once. Only used by one thread at a time.
+class LogCursor {
+public:
+    // Return false to stop before the record, the next read starts with it
+    using Callback = std::function<bool(std::uint64_t offset, std::string_view data)>;
+
+    // `log` must outlive the cursor
+    LogCursor(const TopicLog &log, std::uint64_t from);
+    ~LogCursor();
+
+    LogCursor(const LogCursor &) = delete;
+    LogCursor &operator=(const LogCursor &) = delete;
+
+    // Call `callback` for the written records before `to`, in order, until it
+    // returns false. Records the writer lost are skipped.
+    void read(std::uint64_t to, const Callback &callback);
+
+    // Offset of the next record to read
+    std::uint64_t position() const;
+
+private:
+    const TopicLog &log_;
+    std::uint64_t position_;
+    std::size_t segment_{0};
+    int fd_{-1};
+    // Bytes of the open segment from buffer_file_pos_ on, parsed up to parse_pos_
+    std::string buffer_;
+    std::uint64_t buffer_file_pos_{0};
+    std::size_t parse_pos_{0};
+
+    void open_segment(std::size_t segment);
+    // Read more of the segment, until at least `bytes` are unparsed. False at its end.
+    bool fill(std::size_t bytes);
+};
+
+// Durable topic logs with one writer thread shared by all of them, so
+// publishing only queues records and group commit comes for free.
+class MessageLog {
+public:
+    struct Options {
+        std::filesystem::path directory;
+        FsyncPolicy fsync{FsyncPolicy::BATCH};
+        std::chrono::milliseconds fsync_interval{100};
+        // A new segment is started once the current one exceeds this size
+        std::uint64_t segment_bytes{64 * 1024 * 1024};
+    };
+
+    explicit MessageLog(Options options);
+    // Writes out everything queued, then stops the writer thread
+    ~MessageLog();
+
+    MessageLog(const MessageLog &) = delete;
+    MessageLog &operator=(const MessageLog &) = delete;
+
+    // Log of `topic`, recovered from disk when it already exists. Returns null
+    // when the topic directory can not be created.
+    std::shared_ptr<TopicLog> open(std::string_view topic);
+
+    const Options &options() const;
+
+private:
+    friend class TopicLog;
+
+    struct Record {
+        TopicLog *log;
+        std::uint64_t offset;
+        std::string data;
+    };
+
+    Options options_;
+
+    std::mutex topics_mutex_;
+    std::map<std::string, std::shared_ptr<TopicLog>, std::less<>> topics_;
+
+    std::mutex queue_mutex_;
+    std::condition_variable queue_ready_;
+    std::vector<Record> queue_;
+    bool stopping_{false};
+
+    std::chrono::steady_clock::time_point last_sync_;
+    std::thread writer_;
+
+    void run_writer();
+    void write_batch(std::vector<Record> &batch);
+};
+
+}  // namespace pubsub
+
+#endif // MESSAGE_LOG_H
@@ -0,0 +1,69 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "server_stats.h"
+#include "topic_manager.h"
+
+namespace pubsub::server {
+
+// HTTP listener serving GET /metrics in the Prometheus text format. Rendering
+// only reads counters and the busiest topics, which a background thread
+// ranks every refresh interval, so a scrape never walks the topics on a
+// worker. One request per connection, the response is followed by a close.
+class MetricsServer {
+public:
+    static constexpr std::size_t kDefaultTopTopics{10};
+    static constexpr std::chrono::milliseconds kDefaultRefreshInterval{1000};
+    // Clients that have not sent a whole request by then are disconnected
+    static constexpr std::chrono::seconds kRequestTimeout{5};
+
+    // Turns stage timing on in `stats`, both must outlive the server
+    MetricsServer(boost::asio::io_context &io_context, unsigned short port, ServerStats &stats,
+                  TopicManager &topic_manager, std::size_t top_topics = kDefaultTopTopics,
+                  std::chrono::milliseconds refresh_interval = kDefaultRefreshInterval);
+    ~MetricsServer();
+
+    // The metrics page. Topic rates cover the last refresh interval.
+    std::string render();
+
+private:
+    struct TopicRate {
+        std::string topic;
+        std::uint64_t messages;
+        double rate;
+    };
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    ServerStats &stats_;
+    TopicManager &topic_manager_;
+    std::size_t top_topics_;
+    std::chrono::milliseconds refresh_interval_;
+
+    std::mutex top_mutex_;
+    std::condition_variable refresh_;
+    bool stopping_{false};
+    // Busiest topics at the last refresh, busiest first
+    std::vector<TopicRate> top_;
+
+    // Only used by the refresh thread: topic message counts at the previous refresh, by topic id
+    std::vector<std::uint64_t> previous_counts_;
+    std::chrono::steady_clock::time_point previous_refresh_;
+    std::thread refresher_;
+
+    void start_accept();
+    void handle_request(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+    void refresh_loop();
+    void refresh_top_topics();
+};
+
+}  // namespace pubsub::server
+
+#endif // METRICS_SERVER_H
@@ -0,0 +1,39 @@
+#ifndef OUTBOUND_LIMITS_H
+#define OUTBOUND_LIMITS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace pubsub {
+
+// What happens to a frame that would push a subscriber's outbound queue over
+// its high-water mark
+enum class SlowConsumerPolicy : std::uint8_t {
+    DROP_NEWEST,  // discard the new frame
+    DROP_OLDEST,  // discard queued frames that are not being written yet
+    DISCONNECT,   // close the subscriber's connection
+};
+
+// High-water mark of a subscriber's outbound queue, whichever limit is hit first
+struct OutboundLimits {
+    std::size_t max_bytes{16 * 1024 * 1024};
+    std::size_t max_frames{65536};
+    SlowConsumerPolicy policy{SlowConsumerPolicy::DROP_NEWEST};
+};
+
+// How often each policy fired, shared by every connection of a server
+struct SlowConsumerCounters {
+    std::atomic<std::uint64_t> dropped_newest{0};
+    std::atomic<std::uint64_t> dropped_oldest{0};
+    std::atomic<std::uint64_t> disconnects{0};
+};
+
+// Parse the command line spelling: drop-newest, drop-oldest or disconnect
+std::optional<SlowConsumerPolicy> parse_slow_consumer_policy(std::string_view name);
+
+}  // namespace pubsub
+
+#endif // OUTBOUND_LIMITS_H
@@ -2,45 +2,135 @@
 #define PUBSUB_CLIENT_H
 
 #include <boost/asio.hpp>
+#include <chrono>
 #include <string>
 #include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "message.h"
 #include "client.h"
+#include "compression.h"
+#include "handler_memory.h"
+#include "read_buffer.h"
+#include "shm_channel.h"
 
 namespace pubsub::client {
 
+// Commands are serialized on the calling thread into an outbound buffer. The
+// io_context thread drains everything buffered with a single async_write, so
+// a burst of publishes costs a handful of syscalls instead of one each.
 class PubSubClient : public Client {
 public:
-    explicit PubSubClient(boost::asio::io_context &io_context);
+    static constexpr std::size_t kDefaultMaxBatchBytes{64 * 1024};
+
+    // `protocol` is requested from the server on CONNECT
+    explicit PubSubClient(boost::asio::io_context &io_context, ProtocolVersion protocol = ProtocolVersion::TEXT);
+
+    // Wait up to `linger` for more frames before writing, unless `max_batch_bytes`
+    // are already buffered. The default linger of zero writes as soon as the
+    // io_context gets to it. Set before connecting.
+    void set_write_batching(std::chrono::microseconds linger,
+                            std::size_t max_batch_bytes = kDefaultMaxBatchBytes);
+
+    // Ask the server on CONNECT to compress large payloads for this client,
+    // binary protocol only. Once accepted, publishes of at least `threshold`
+    // bytes are sent compressed as well. Received payloads are always handed
+    // to on_message_received decompressed. Set before connecting.
+    void enable_compression(std::size_t threshold = compression::kDefaultThreshold);
 
     // message commands
     void connect(const std::string& client_name);
     void disconnect();
     void publish(const std::string& topic, const std::string& data);
-    void subscribe(const std::string& topic);
+    // From `offset` on the server first replays the topic's log, if it keeps one
+    void subscribe(const std::string& topic, std::uint64_t offset = kNoOffset);
     void unsubscribe(const std::string& topic);
+    // Ask the server for its counters, the answer arrives in on_stats_received
+    void stats();
 
     // socket
     void connect_socket(const std::string& host, const std::string& port);
+    // Connect to a server on this host through its Unix domain socket at `path`
+    void connect_local(const std::string& path);
+    // Same, then exchange all frames through shared memory rings of `ring_bytes`
+    // each instead of the socket. With a spin time, an idle ring is polled that
+    // long before waiting for a doorbell, trading a busy io_context thread for
+    // latency.
+    void connect_shared_memory(const std::string& path, std::chrono::microseconds spin = {},
+                               std::size_t ring_bytes = ShmChannel::kDefaultRingBytes);
     void disconnect_socket();
 
 protected:
     void on_message_received(const std::string &topic, const std::string& message) override;
-    void write(const Message &message) override;
+    void on_stats_received(const std::string &stats) override;
+    // Buffer the frame for the next flush, called with outbound_mutex_ held
+    void write(const MessageView &message) override;
 
 private:
-    using SocketSPtr = std::shared_ptr<boost::asio::ip::tcp::socket>;
-    using StringSPtr = std::shared_ptr<std::string>;
-    using BufferSPtr = std::shared_ptr<std::array<char, 1024>>;
+    // TCP or Unix domain stream socket
+    using SocketSPtr = std::shared_ptr<boost::asio::generic::stream_protocol::socket>;
 
-    boost::asio::executor exec_;
+    // Concrete type, a polymorphic executor would not use the handler allocators
+    boost::asio::io_context::executor_type exec_;
     SocketSPtr socket_;
     std::string client_name_;
+    ProtocolVersion requested_protocol_;
+    // Smallest publish to compress, 0 if compression is not requested
+    std::size_t compression_threshold_{0};
+    ProtocolVersion read_protocol_{ProtocolVersion::TEXT};
+
+    // Guards the members below, which the calling threads use to serialize
+    std::mutex outbound_mutex_;
+    // Both directions switch once the CONNACK accepted the version
+    ProtocolVersion write_protocol_{ProtocolVersion::TEXT};
+    // The server may already read the requested version, frames wait for the
+    // CONNACK to tell which one
+    bool awaiting_connack_{false};
+    std::vector<Message> held_;
+    // Set once the server accepted compression in its CONNACK
+    bool write_compression_{false};
+    // Topic aliases defined on this connection, binary protocol only
+    std::unordered_map<std::string, std::uint32_t> topic_aliases_;
+    // Frames serialized since the last flush
+    std::string outbound_;
+    bool flush_scheduled_{false};
+    // Compressed publish data, reused so its capacity stays
+    std::string compressed_;
+    // Flushes posted from the calling threads, shared so it outlives posts
+    // still queued when the client goes away
+    std::shared_ptr<HandlerMemory> flush_memory_{std::make_shared<HandlerMemory>()};
+
+    // Only used on the io_context thread
+    std::string writing_;
+    // Topic and data handed to on_message_received, reused so their capacity stays
+    std::string received_topic_;
+    std::string received_data_;
+    bool write_in_progress_{false};
+    // Shared memory rings replacing the socket, if connected that way
+    std::unique_ptr<ShmChannel> channel_;
+    // Bytes of writing_ already in the ring
+    std::size_t ring_written_{0};
+    std::chrono::microseconds spin_{0};
+    boost::asio::steady_timer linger_timer_;
+    std::chrono::microseconds linger_{0};
+    std::size_t max_batch_bytes_{kDefaultMaxBatchBytes};
+
+    void assign_topic_alias(const std::string &topic, MessageView &msg);
+    // Write the frame, or hold it until the CONNACK arrives. Called with outbound_mutex_ held.
+    void send(const MessageView &message);
+    void schedule_flush();
+    void flush();
+    void handle_write(const boost::system::error_code &error, std::size_t bytes_transferred);
+    void flush_ring();
+    // Read and handle what the ring holds, true if the client then parked
+    bool service_ring(ReadBuffer &buffer, std::chrono::steady_clock::time_point &idle_since);
+    // Handle the complete frames in `buffer`
+    void process_frames(ReadBuffer &buffer);
 
-    void handle_read(SocketSPtr socket, StringSPtr client_buffer, BufferSPtr read_buffer,
-                     const boost::system::error_code &error,
-                     std::size_t bytes_transferred);
-    void start_reading();
+    // Read loops of one connection, their buffers live in the coroutine frame
+    boost::asio::awaitable<void> read_loop(SocketSPtr socket);
+    boost::asio::awaitable<void> ring_loop(SocketSPtr socket);
 };
 
 }  // namespace pubsub::client
@@ -2,36 +2,83 @@
 #define PUBSUB_SERVER_H
 
 #include <boost/asio.hpp>
+#include <chrono>
 #include <memory>
 #include <unordered_map>
 #include <set>
 #include <string>
+#include "read_buffer.h"
 #include "server.h"
+#include "server_stats.h"
 
 namespace pubsub::server {
 
 class PubSubServer : public Server {
 public:
     explicit PubSubServer(boost::asio::io_context& io_context, short port);
+    // One worker of a multi threaded server. Workers share the topic manager and
+    // bind with SO_REUSEPORT so the kernel spreads connections between them, each
+    // connection then stays on the thread running `io_context`. Workers sharing
+    // `stats` report the counters of all of them on STATS.
+    PubSubServer(boost::asio::io_context& io_context, short port, std::shared_ptr<TopicManager> topic_manager,
+                 std::shared_ptr<ServerStats> stats = nullptr);
+    // Removes the Unix socket file, if listening on one
+    ~PubSubServer();
+
+    // Also accept clients on a Unix domain socket at `path`, for publishers and
+    // subscribers on the same host. They use the same framing and routing as TCP
+    // clients. A stale socket file left at `path` is replaced. False on error.
+    bool listen_local(const std::string &path);
+
+    // Local clients can move their connection to shared memory rings (SHM
+    // frame). With a spin time, the server keeps polling an idle ring that long
+    // before it waits for a doorbell, trading a busy worker for latency.
+    void set_shared_memory_spin(std::chrono::microseconds spin);
+
+    // Routing table of this server, shared with the other workers if any
+    TopicManager &topic_manager();
+    // Counters of this server, shared with the other workers if any
+    ServerStats &stats();
 
 protected:
-    using SocketSPtr = std::shared_ptr<boost::asio::ip::tcp::socket>;
-    using StringSPtr = std::shared_ptr<std::string>;
-    using BufferSPtr = std::shared_ptr<std::array<char, 1024>>;
+    using ConnectionSPtr = std::shared_ptr<Connection>;
 
-    void handle_disconnect(SocketSPtr socket) override;
-    void process_message(SocketSPtr socket, const std::string &message) override;
+    // Unsubscribe and close, only the first call for a connection does anything
+    void handle_disconnect(ConnectionSPtr connection) override;
+    void process_message(ConnectionSPtr connection, std::string_view message) override;
 
 private:
     boost::asio::ip::tcp::acceptor acceptor_;
-    TopicManager topic_manager_;
+    boost::asio::local::stream_protocol::acceptor local_acceptor_;
+    std::string local_path_;
+    std::chrono::microseconds shm_spin_{0};
+    std::shared_ptr<TopicManager> topic_manager_;
+    std::shared_ptr<ServerStats> stats_;
+    // Counters and connections of this worker
+    std::shared_ptr<ServerStats::Worker> worker_;
     boost::asio::ip::tcp::endpoint endp_;
+    // Payload of the last compressed publish, reused so its capacity stays
+    std::string inflated_;
 
-    void start_accept();
-    void handle_accept(SocketSPtr socket, const boost::system::error_code& error);
-    void handle_read(SocketSPtr socket, StringSPtr client_buffer, BufferSPtr read_buffer,
-                     const boost::system::error_code &error,
-                     std::size_t bytes_transferred);
+    // Accept clients until the acceptor fails or is closed
+    template <typename Acceptor>
+    boost::asio::awaitable<void> accept_loop(Acceptor &acceptor);
+    void handle_accept(ConnectionSPtr connection);
+    // Read loop of one client, its buffers live in the coroutine frame
+    boost::asio::awaitable<void> session(ConnectionSPtr connection);
+    // Frames come through the ring once a local client attached, the socket only carries doorbells
+    boost::asio::awaitable<void> shared_memory_session(ConnectionSPtr connection);
+    // Read and process what the ring holds, true if the server then parked
+    bool service_shared_memory(const ConnectionSPtr &connection, ReadBuffer &buffer,
+                               std::chrono::steady_clock::time_point &idle_since);
+    void negotiate_protocol(ConnectionSPtr connection, ProtocolVersion requested, std::uint8_t capabilities);
+    void publish_aliased(const ConnectionSPtr &connection, const MessageView &msg, std::string_view data,
+                         std::string_view compressed);
+    void send_stats(const ConnectionSPtr &connection);
+    // Create rings of `ring_bytes` for a local client and pass them over its socket
+    void attach_shared_memory(const ConnectionSPtr &connection, std::string_view ring_bytes);
+    // Process the complete frames in `buffer`, stopping after an SHM frame or once closed
+    void process_frames(const ConnectionSPtr &connection, ReadBuffer &buffer);
 };
 
 }  // namespace pubsub::server
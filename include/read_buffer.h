@@ -0,0 +1,42 @@
+#ifndef READ_BUFFER_H
+#define READ_BUFFER_H
+
+#include <boost/asio/buffer.hpp>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace pubsub {
+
+// Receive buffer of a single connection. Reads go straight into the free space
+// after the unread bytes and consumed frames only advance an offset, the unread
+// tail is moved to the front when space runs out. The read size doubles while
+// reads fill it and halves again when they come back mostly empty.
+class ReadBuffer {
+public:
+    static constexpr std::size_t kMinReadSize{1024};
+    static constexpr std::size_t kMaxReadSize{64 * 1024};
+
+    // Free space for the next read, valid until the next call to prepare()
+    boost::asio::mutable_buffer prepare();
+    // Make `bytes` read into the prepared space part of data()
+    void commit(std::size_t bytes);
+
+    // Received bytes not consumed yet
+    std::string_view data() const;
+    // Drop `bytes` from the front of data()
+    void consume(std::size_t bytes);
+
+    std::size_t read_size() const;
+    std::size_t capacity() const;
+
+private:
+    std::vector<char> storage_;
+    std::size_t begin_{0};
+    std::size_t end_{0};
+    std::size_t read_size_{kMinReadSize};
+};
+
+}  // namespace pubsub
+
+#endif // READ_BUFFER_H
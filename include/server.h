@@ -6,6 +6,8 @@
 #include <unordered_map>
 #include <set>
 #include <string>
+#include <string_view>
+#include "connection.h"
 #include "topic_manager.h"
 
 namespace pubsub::server {
@@ -13,8 +15,8 @@ namespace pubsub::server {
 class Server {
 
 protected:
-    virtual void process_message(std::shared_ptr<boost::asio::ip::tcp::socket> socket, const std::string &message) = 0;
-    virtual void handle_disconnect(std::shared_ptr<boost::asio::ip::tcp::socket> socket) = 0;
+    virtual void process_message(std::shared_ptr<Connection> connection, std::string_view message) = 0;
+    virtual void handle_disconnect(std::shared_ptr<Connection> connection) = 0;
 };
 
 }
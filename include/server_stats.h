@@ -0,0 +1,163 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace pubsub {
+
+class Connection;
+class TopicManager;
+
+// Add to a counter only one thread writes. A relaxed load and store instead of
+// a locked read-modify-write, readers on other threads still see whole values.
+inline void add_local(std::atomic<std::uint64_t> &counter, std::uint64_t value = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// Same for taking a gauge down
+inline void sub_local(std::atomic<std::uint64_t> &gauge, std::uint64_t value = 1) {
+    gauge.store(gauge.load(std::memory_order_relaxed) - value, std::memory_order_relaxed);
+}
+
+// Upper bounds of the stage duration buckets, in nanoseconds
+constexpr std::array<std::uint64_t, 16> kStageBucketBounds{
+    250,     500,     1000,     2500,     5000,     10000,    25000,    50000,
+    100000,  250000,  500000,   1000000,  2500000,  5000000,  10000000, 100000000,
+};
+
+// Stage durations bucketed by kStageBucketBounds, the last bucket takes the rest.
+// Written by a single thread like the counters below.
+struct StageHistogram {
+    std::array<std::atomic<std::uint64_t>, kStageBucketBounds.size() + 1> buckets{};
+    std::atomic<std::uint64_t> sum_ns{0};
+
+    void record(std::chrono::steady_clock::duration duration);
+};
+
+// Traffic of one server worker, written only by the worker's thread
+struct alignas(64) TrafficCounters {
+    std::atomic<std::uint64_t> frames_in{0};
+    std::atomic<std::uint64_t> bytes_in{0};
+    std::atomic<std::uint64_t> frames_out{0};
+    std::atomic<std::uint64_t> bytes_out{0};
+    std::atomic<std::uint64_t> write_errors{0};
+    std::atomic<std::uint64_t> connections_accepted{0};
+    // Gauges: open connections and what their outbound queues hold
+    std::atomic<std::uint64_t> connections{0};
+    std::atomic<std::uint64_t> queued_frames{0};
+    std::atomic<std::uint64_t> queued_bytes{0};
+
+    // Stage durations, only taken while timing is on since reading the clock
+    // costs more than all the counters together
+    std::atomic<bool> timing{false};
+    StageHistogram parse;   // frame to message view
+    StageHistogram route;   // publish through the routing table up to the subscriber queues
+    StageHistogram write;   // async_write of a batch of frames until it completes
+};
+
+// Times one stage into `histogram` when timing is on
+class StageTimer {
+public:
+    StageTimer(const TrafficCounters &traffic, StageHistogram &histogram)
+        : histogram_(traffic.timing.load(std::memory_order_relaxed) ? &histogram : nullptr),
+          start_(histogram_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point()) {}
+
+    ~StageTimer() {
+        stop();
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+    void stop() {
+        if (histogram_) {
+            histogram_->record(std::chrono::steady_clock::now() - start_);
+            histogram_ = nullptr;
+        }
+    }
+
+private:
+    StageHistogram *histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Point in time view of a server, as returned by the STATS command
+struct StatsSnapshot {
+    struct Queue {
+        std::string peer;
+        std::size_t frames{0};
+        std::size_t bytes{0};
+    };
+
+    struct Histogram {
+        std::array<std::uint64_t, kStageBucketBounds.size() + 1> buckets{};
+        std::uint64_t sum_ns{0};
+    };
+
+    std::uint64_t frames_in{0};
+    std::uint64_t bytes_in{0};
+    std::uint64_t frames_out{0};
+    std::uint64_t bytes_out{0};
+    std::uint64_t write_errors{0};
+    std::uint64_t connections_accepted{0};
+    std::size_t connections{0};
+    std::size_t topics{0};
+    std::size_t subscriptions{0};
+    std::uint64_t unrouted_publishes{0};
+    std::uint64_t dropped_newest{0};
+    std::uint64_t dropped_oldest{0};
+    std::uint64_t slow_consumer_disconnects{0};
+    std::uint64_t queued_frames{0};
+    std::uint64_t queued_bytes{0};
+    // Outbound queue of every open connection, only filled by snapshot()
+    std::vector<Queue> queues;
+    // Stage durations, empty unless timing is on
+    Histogram parse;
+    Histogram route;
+    Histogram write;
+
+    // Space separated key=value pairs, one queue=<peer>,<frames>,<bytes> per connection
+    std::string format() const;
+};
+
+// Counters and open connections of every worker of a server, shared between
+// the workers like the topic manager. Counting a frame is a relaxed store to
+// the worker's own cache line, all the adding up happens in snapshot().
+class ServerStats {
+public:
+    struct Worker {
+        TrafficCounters traffic;
+        // Guards `connections`, only taken on connect, disconnect and snapshot
+        std::mutex mutex;
+        std::unordered_set<std::shared_ptr<Connection>> connections;
+    };
+
+    // Register a worker, its counters stay in the totals after it is gone
+    std::shared_ptr<Worker> add_worker();
+
+    // Time the parse, route and write stages on every worker, including later ones
+    void set_timing(bool enabled);
+
+    // Totals of every worker plus the routing table figures of `topic_manager`.
+    // Only reads counters, never the connections or their locks.
+    StatsSnapshot totals(const TopicManager &topic_manager) const;
+    // Same, plus the outbound queue of every open connection
+    StatsSnapshot snapshot(const TopicManager &topic_manager) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<Worker>> workers_;
+    bool timing_{false};
+};
+
+}  // namespace pubsub
+
+#endif // SERVER_STATS_H
@@ -0,0 +1,108 @@
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace pubsub {
+
+// Positions of one ring, counted in bytes since the segment was created. Each
+// side writes only its own, they sit on separate cache lines.
+struct ShmRingIndex {
+    alignas(64) std::atomic<std::uint64_t> head{0};  // written by the producer
+    alignas(64) std::atomic<std::uint64_t> tail{0};  // written by the consumer
+};
+
+// Lock-free single producer, single consumer byte pipe in memory shared by
+// two processes. It carries the same byte stream as a socket would, so frames
+// may wrap around and a write may only take part of its input.
+class ShmRing {
+public:
+    // `capacity` must be a power of two
+    ShmRing(ShmRingIndex &index, char *data, std::size_t capacity);
+
+    // Copy as much of `data` as fits, returns the bytes taken. Producer only.
+    std::size_t write(const char *data, std::size_t size);
+    // Copy up to `size` bytes out, returns the bytes read. Consumer only.
+    std::size_t read(char *data, std::size_t size);
+
+    // Bytes waiting to be read
+    bool readable() const;
+    // Space left to write into
+    bool writable() const;
+
+    std::size_t capacity() const;
+
+private:
+    ShmRingIndex &index_;
+    char *data_;
+    std::size_t capacity_;
+};
+
+// Two rings in a shared memory segment, one per direction. The server creates
+// the segment for a client on the broker host and passes its descriptor over
+// the Unix socket. The size is sealed, so the client can not shrink the memory
+// the server has mapped. Neither side ever blocks on the other. A side with
+// nothing left to do parks, and the peer rings its doorbell, a byte on the
+// Unix socket the session was set up over, the next time it touches the
+// rings. While both sides are busy frames pass without a single syscall.
+class ShmChannel {
+public:
+    static constexpr std::size_t kDefaultRingBytes{1024 * 1024};
+    static constexpr std::size_t kMinRingBytes{4 * 1024};
+    static constexpr std::size_t kMaxRingBytes{1024 * 1024 * 1024};
+
+    // Server side: create a sealed anonymous segment with rings of `ring_bytes`,
+    // rounded up to a power of two within the limits. Null on error.
+    static std::unique_ptr<ShmChannel> create(std::size_t ring_bytes = kDefaultRingBytes);
+    // Client side: map the segment passed by the server, taking over `fd`.
+    // Null on error.
+    static std::unique_ptr<ShmChannel> open(int fd);
+
+    ~ShmChannel();
+
+    ShmChannel(const ShmChannel &) = delete;
+    ShmChannel &operator=(const ShmChannel &) = delete;
+
+    ShmRing &inbound();
+    ShmRing &outbound();
+    // Descriptor of the segment, to pass to the client. Open until the channel is destroyed.
+    int fd() const;
+
+    // Mark this side idle, so the peer rings the doorbell after its next ring
+    // operation. False, and not parked, if the rings already have work: bytes
+    // to read, or room for `pending_output`.
+    bool park(bool pending_output);
+    // Clear the idle mark, the peer stops ringing
+    void wake();
+    // Send a doorbell on `socket` if the peer is parked, after writing to or
+    // reading from a ring
+    void notify_peer(int socket);
+
+private:
+    struct Header;
+
+    ShmChannel(int fd, void *memory, std::size_t size, std::size_t ring_bytes, bool server);
+
+    int fd_;
+    void *memory_;
+    std::size_t size_;
+    Header *header_;
+    std::atomic<std::uint32_t> &parked_;
+    std::atomic<std::uint32_t> &peer_parked_;
+    ShmRing inbound_;
+    ShmRing outbound_;
+};
+
+// Pass `fd` over the Unix stream socket `socket`, attached to a single byte.
+// False on error.
+bool send_descriptor(int socket, int fd);
+// Wait for a descriptor sent with send_descriptor. -1 on error or if the byte
+// came without one.
+int receive_descriptor(int socket);
+
+}  // namespace pubsub
+
+#endif // SHM_CHANNEL_H
@@ -0,0 +1,19 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <boost/asio/co_spawn.hpp>
+#include <exception>
+
+namespace pubsub {
+
+// Completion handler for co_spawn. An exception leaving a coroutine escapes
+// io_context::run(), the same as one thrown by a plain handler.
+inline void rethrow_on_error(std::exception_ptr error) {
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}  // namespace pubsub
+
+#endif // SPAWN_H
@@ -0,0 +1,41 @@
+#ifndef TOPIC_H
+#define TOPIC_H
+
+#include <string_view>
+
+// Hierarchical topic names. Levels are separated by '.', a subscription filter
+// may use '*' as a whole level to match exactly one level, and '#' as its last
+// level to match any number of remaining levels, including none:
+//   md.equities.*   matches md.equities.aapl but not md.equities.aapl.bid
+//   md.#            matches md, md.equities and md.equities.aapl.bid
+namespace pubsub::topic {
+
+constexpr char kSeparator{'.'};
+constexpr std::string_view kSingleLevelWildcard{"*"};
+constexpr std::string_view kMultiLevelWildcard{"#"};
+
+// True if the filter contains a wildcard level
+bool is_filter(std::string_view topic);
+// A filter may only use '#' as its last level
+bool is_valid_filter(std::string_view filter);
+// Published topic names must not contain wildcard levels
+bool is_valid_name(std::string_view name);
+// True if the topic `name` is matched by `filter`, same rules as the routing table
+bool matches(std::string_view filter, std::string_view name);
+
+// Walks the levels of a topic without copying, cheap to copy for backtracking
+class LevelIterator {
+public:
+    explicit LevelIterator(std::string_view topic);
+
+    // Set `level` to the next level, returns false once all levels are consumed
+    bool next(std::string_view &level);
+
+private:
+    std::string_view rest_;
+    bool done_{false};
+};
+
+}  // namespace pubsub::topic
+
+#endif // TOPIC_H
@@ -1,23 +1,214 @@
 #ifndef TOPIC_MANAGER_H
 #define TOPIC_MANAGER_H
 
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <set>
 #include <string>
+#include <string_view>
 #include <boost/asio.hpp>
+#include <atomic>
 #include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <vector>
+#include "compression.h"
+#include "connection.h"
+#include "message_log.h"
+#include "outbound_limits.h"
+#include "server_stats.h"
+#include "topic_trie.h"
 
 namespace pubsub {
 
+// Routing table shared by all server workers, safe to use from any thread.
+// Topics are spread by hash over independently locked shards: publishes only
+// take a shared lock on the shard of their topic and never contend with each
+// other, subscribe and unsubscribe exclusively lock just that one shard.
+//
+// Topic names are interned into dense ids: a shard keeps its topics in a
+// table indexed by slot, and the id of a topic is its slot times the shard
+// count plus its shard index. Publishing by id skips hashing the name. A slot
+// is reused once its topic has no subscribers, log, limits or interned ids.
+//
+// With a retained budget the last payload of every topic is kept and sent to
+// new subscribers right away. One least recently used list spans all shards,
+// so any value up to the whole budget can be retained.
+//
+// A subscriber replaying a topic's log catches up outside the shard lock, a
+// chunk at a time as its outbound queue drains. Once it reaches the end of
+// the log, live publishes are held for it until the last records are read,
+// then it joins the topic's subscribers.
+//
+// Large payloads are compressed at most once per publish, and only if a
+// subscriber accepted compression. Those subscribers share the compressed
+// frame, the others share the plain one.
 class TopicManager final {
 public:
-    void subscribe(const std::string& topic, std::shared_ptr<boost::asio::ip::tcp::socket> socket);
-    void unsubscribe(const std::string& topic, std::shared_ptr<boost::asio::ip::tcp::socket> socket);
-    void unsubscribe_all(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
-    void publish(const std::string& topic, const std::string& data);
+    using TopicId = std::uint32_t;
+
+    static constexpr std::size_t kDefaultShardCount{64};
+    // Most records and bytes a replay queues at once, within half the subscriber's limits
+    static constexpr std::size_t kReplayChunkFrames{1024};
+    static constexpr std::size_t kReplayChunkBytes{1024 * 1024};
+
+    explicit TopicManager(std::size_t shard_count = kDefaultShardCount);
+
+    // Id of a concrete topic name, registered on first use. Every call pins
+    // the id until a matching release(), only then can it be reused.
+    TopicId intern(std::string_view topic);
+    void release(TopicId topic);
+
+    // New subscribers first get the retained value of the topic, or of every
+    // topic a wildcard filter matches. With `replay_from` they instead get the
+    // topic's logged messages from that offset on. Live messages follow
+    // without gaps or duplicates.
+    void subscribe(std::string_view topic, std::shared_ptr<Connection> connection,
+                   std::uint64_t replay_from = kNoOffset);
+    void unsubscribe(std::string_view topic, std::shared_ptr<Connection> connection);
+    void unsubscribe_all(std::shared_ptr<Connection> connection);
+    // `compressed` is `data` as the publisher already compressed it, if it did
+    void publish(std::string_view topic, std::string_view data, std::string_view compressed = {});
+    // Publish to a topic returned by intern(), unknown ids are ignored
+    void publish(TopicId topic, std::string_view data, std::string_view compressed = {});
+
+    // High-water mark applied to every subscriber, set before publishing starts
+    void set_default_limits(const OutboundLimits &limits);
+    // Override the default for subscribers receiving `topic`, also when they
+    // subscribed through a wildcard filter
+    void set_topic_limits(std::string_view topic, const OutboundLimits &limits);
+    const SlowConsumerCounters &slow_consumer_counters() const;
+
+    // Fill in the topics with subscribers, the subscriptions including wildcard
+    // filters, publishes nobody received and the slow consumer counters. Only
+    // reads counters, takes no locks.
+    void add_stats(StatsSnapshot &snapshot) const;
+
+    // Call `visitor` with the id and the messages published so far of every
+    // interned topic that got one. Shard locks are only taken shared, publishing
+    // goes on, so `visitor` must not call back into the manager.
+    void visit_message_counts(const std::function<void(TopicId, std::uint64_t)> &visitor);
+    // Name of an interned topic, empty if the id is not in use
+    std::string topic_name(TopicId topic);
+
+    // Keep the last payload of each topic in at most `bytes` of topic names and
+    // payloads, 0 (the default) retains nothing. Set before publishing starts.
+    void set_retained_budget(std::size_t bytes);
+
+    // Subscribers that accepted compression get payloads from `bytes` on
+    // compressed, 0 turns it off. Set before publishing starts.
+    void set_compression_threshold(std::size_t bytes);
+    std::size_t compression_threshold() const;
+
+    // Keep every message published to `topic` in `log`, and number them with
+    // its offsets. Returns false if the log can not be opened.
+    bool enable_log(std::string_view topic, MessageLog &log);
 
 private:
-    std::unordered_map<std::string, std::set<std::shared_ptr<boost::asio::ip::tcp::socket>>> topics_;
+    struct Replay;
+
+    struct Topic {
+        std::string name;
+        std::set<std::shared_ptr<Connection>> subscribers;
+        // Subscribers still catching up from the log
+        std::unordered_map<std::shared_ptr<Connection>, std::shared_ptr<Replay>> replays;
+        std::optional<OutboundLimits> limits;
+        std::shared_ptr<TopicLog> log;
+        // Ids handed out by intern() and not released yet
+        std::size_t pins{0};
+        // Publishes, counted under the shared shard lock
+        mutable std::atomic<std::uint64_t> messages{0};
+    };
+
+    // A subscriber catching up from the log of a topic
+    struct Replay {
+        std::shared_ptr<Connection> connection;
+        TopicId topic;
+        std::string name;
+        std::shared_ptr<TopicLog> log;
+        OutboundLimits limits;
+        // Only used on the connection's thread, continues where the last chunk stopped
+        std::unique_ptr<LogCursor> cursor;
+        // Set with the shard locked exclusively, publishes from this offset on are held
+        std::uint64_t handoff{kNoOffset};
+        // Cleared by unsubscribing, the replay then stops at its next step
+        std::atomic<bool> active{true};
+        // Live frames for after the replay, added under the shared shard lock
+        // within the subscriber's limits, like a queue of their own
+        std::mutex held_mutex;
+        std::deque<Connection::FrameSPtr> held;
+        std::size_t held_bytes{0};
+        // The disconnect policy fired, nothing is held anymore
+        bool closing{false};
+    };
+
+    struct Retained {
+        std::string topic;
+        std::string data;
+    };
+    using RetainedList = std::list<Retained>;
+
+    // Reverse index, the topics of this shard each connection is subscribed to
+    using SubscriptionMap = std::unordered_map<std::shared_ptr<Connection>, std::unordered_set<TopicId>>;
+
+    // Cache line aligned so neighbouring shard locks do not false share
+    struct alignas(64) Shard {
+        std::shared_mutex mutex;
+        // Interned topics by slot, a deque so names never move. Free slots have no name.
+        std::deque<Topic> topics;
+        std::vector<std::uint32_t> free_slots;
+        // Views into the names in `topics`
+        std::unordered_map<std::string_view, std::uint32_t> slots;
+        SubscriptionMap subscriptions;
+    };
+
+    std::vector<Shard> shards_;
+    OutboundLimits default_limits_;
+    SlowConsumerCounters slow_consumer_counters_;
+    std::atomic<std::uint64_t> unrouted_publishes_{0};
+    // Kept up to date on subscribe and unsubscribe so stats need no locks
+    std::atomic<std::size_t> active_topics_{0};
+    std::atomic<std::size_t> subscription_count_{0};
+    std::size_t retained_budget_{0};
+    // Taken inside shard locks, never the other way around
+    std::mutex retained_mutex_;
+    // Most recently used first
+    RetainedList retained_;
+    // Views into the topics in `retained_`
+    std::unordered_map<std::string_view, RetainedList::iterator> retained_index_;
+    std::size_t retained_bytes_{0};
+    std::size_t compression_threshold_{compression::kDefaultThreshold};
+
+    std::shared_mutex wildcard_mutex_;
+    TopicTrie wildcards_;
+    std::unordered_map<std::shared_ptr<Connection>, std::unordered_set<std::string>> wildcard_subscriptions_;
+    std::atomic<bool> has_wildcards_{false};
+
+    // False if `connection` already had this subscription
+    bool subscribe_wildcard(std::string_view filter, std::shared_ptr<Connection> connection);
+    void unsubscribe_wildcard(std::string_view filter, const std::shared_ptr<Connection> &connection);
+    void unsubscribe_all_wildcards(const std::shared_ptr<Connection> &connection);
+
+    std::size_t shard_index(std::string_view topic) const;
+    TopicId intern_locked(Shard &shard, std::size_t index, std::string_view topic);
+    void remove_subscriber(Topic &topic, const std::shared_ptr<Connection> &connection);
+    void reclaim(Shard &shard, std::uint32_t slot);
+    void deliver(std::string_view topic, const Topic *exact, std::string_view data, std::string_view compressed);
+    void add_subscriber(Topic &topic, const std::shared_ptr<Connection> &connection);
+    void continue_replay(const std::shared_ptr<Replay> &replay);
+    // Hold a live frame for a replay past its handoff, applying its limits and policy
+    void hold(Replay &replay, const Connection::FrameSPtr &frame);
+    // Read the next chunk of the log into the connection's queue, false if the writer has not written it yet
+    bool send_replay_chunk(Replay &replay, std::uint64_t end);
+    void finish_replay(const std::shared_ptr<Replay> &replay);
+    void retain(std::string_view topic, std::string_view data);
+    void send_retained(const Topic &topic, const std::shared_ptr<Connection> &connection);
+    void send_retained_matching(std::string_view filter, const std::shared_ptr<Connection> &connection);
 };
 
 }  // namespace pubsub
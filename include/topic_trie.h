@@ -0,0 +1,44 @@
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "connection.h"
+#include "topic.h"
+
+namespace pubsub {
+
+// Wildcard subscriptions indexed by level. Matching a topic walks at most the
+// exact, '*' and '#' children per level, so its cost depends on the depth of
+// the topic and not on how many filters are subscribed. Not thread safe.
+class TopicTrie final {
+public:
+    // Returns true if the connection was not subscribed to `filter` yet
+    bool insert(std::string_view filter, std::shared_ptr<Connection> connection);
+    // Returns true if the connection was subscribed to `filter`
+    bool erase(std::string_view filter, const std::shared_ptr<Connection> &connection);
+    // Append the subscribers of every filter matching `topic`, possibly with duplicates
+    void match(std::string_view topic, std::vector<std::shared_ptr<Connection>> &subscribers) const;
+
+    bool empty() const;
+
+private:
+    struct Node {
+        std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+        std::set<std::shared_ptr<Connection>> subscribers;
+    };
+
+    Node root_;
+
+    static void match_node(const Node &node, topic::LevelIterator levels,
+                           std::vector<std::shared_ptr<Connection>> &subscribers);
+    static bool erase_node(Node &node, topic::LevelIterator levels, const std::shared_ptr<Connection> &connection);
+};
+
+}  // namespace pubsub
+
+#endif // TOPIC_TRIE_H
@@ -1,25 +1,11 @@
 #include <boost/asio.hpp>
-#include <boost/log/trivial.hpp>
-#include <boost/log/utility/setup/common_attributes.hpp>
-#include <boost/log/utility/setup/console.hpp>
 #include <iostream>
 #include <sstream>
 #include <thread>
 #include "console.h"
+#include "logging.h"
 #include "pubsub_client.h"
 
-void init_logging(bool debug) {
-    boost::log::add_console_log(std::cout, boost::log::keywords::format = "%TimeStamp% [%Severity%]: %Message%");
-    boost::log::add_common_attributes();
-    const auto severity = debug ? boost::log::trivial::debug : boost::log::trivial::info;
-
-    boost::log::core::get()->set_filter(boost::log::trivial::severity >= severity);
-
-    if (debug) {
-        BOOST_LOG_TRIVIAL(debug) << "Debug mode enabled.\n";
-    }
-}
-
 int main(int argc, char *argv[]) {
     bool debug{false};
 
@@ -33,7 +19,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    init_logging(debug);
+    pubsub::logging::init(debug ? boost::log::trivial::debug : boost::log::trivial::info);
 
     boost::asio::io_context io_context;
     pubsub::client::PubSubClient client(io_context);
@@ -1,6 +1,7 @@
 #include "console.h"
 
 #include <boost/log/trivial.hpp>
+#include <algorithm>
 
 namespace pubsub::client {
 
@@ -8,10 +9,13 @@ void print_help() {
     BOOST_LOG_TRIVIAL(info) << "Available commands:";
     BOOST_LOG_TRIVIAL(info)
         << "  CONNECT <port> <client_name> - Connect to the server on the specified port with a client name";
+    BOOST_LOG_TRIVIAL(info)
+        << "  CONNECT <path> <client_name> - Connect through the server's Unix socket, for paths containing a '/'";
     BOOST_LOG_TRIVIAL(info) << "  DISCONNECT                  - Disconnect from the server";
     BOOST_LOG_TRIVIAL(info) << "  PUBLISH <topic> <data>      - Publish a message to a topic";
-    BOOST_LOG_TRIVIAL(info) << "  SUBSCRIBE <topic>           - Subscribe to a topic";
+    BOOST_LOG_TRIVIAL(info) << "  SUBSCRIBE <topic> [offset]  - Subscribe to a topic, replaying its log from offset";
     BOOST_LOG_TRIVIAL(info) << "  UNSUBSCRIBE <topic>         - Unsubscribe from a topic";
+    BOOST_LOG_TRIVIAL(info) << "  STATS                       - Show the server's counters";
     BOOST_LOG_TRIVIAL(info) << "  HELP                        - Display this help message";
 }
 
@@ -31,7 +35,11 @@ void handle_console_input(boost::asio::posix::stream_descriptor &input, PubSubCl
                     } else {
                         std::string port = command.substr(8, space1 - 8);
                         std::string name = command.substr(space1 + 1);
-                        client.connect_socket("127.0.0.1", port);
+                        if (port.find('/') != std::string::npos) {
+                            client.connect_local(port);
+                        } else {
+                            client.connect_socket("127.0.0.1", port);
+                        }
                         client.connect(name);
                     }
                 } else if (command == Message::kDisconnectCommand) {
@@ -46,12 +54,22 @@ void handle_console_input(boost::asio::posix::stream_descriptor &input, PubSubCl
                         std::string data = command.substr(space1 + 1);
                         client.publish(topic, data);
                     }
-                } else if (command.substr(0, Message::kPublishCommand.size()) == Message::kPublishCommand) {
-                    std::string topic = command.substr(10);
+                } else if (command.substr(0, Message::kSubscribeCommand.size()) == Message::kSubscribeCommand) {
+                    std::string topic = command.size() > 10 ? command.substr(10) : std::string();
+                    std::uint64_t offset{kNoOffset};
+                    // Optional replay offset after the topic
+                    if (size_t space1 = topic.find(' '); space1 != std::string::npos) {
+                        try {
+                            offset = std::stoull(topic.substr(space1 + 1));
+                        } catch (const std::exception &e) {
+                            topic.clear();
+                        }
+                        topic.resize(std::min(space1, topic.size()));
+                    }
                     if (topic.empty()) {
-                        BOOST_LOG_TRIVIAL(error) << "Invalid SUBSCRIBE command. Usage: SUBSCRIBE <topic>";
+                        BOOST_LOG_TRIVIAL(error) << "Invalid SUBSCRIBE command. Usage: SUBSCRIBE <topic> [offset]";
                     } else {
-                        client.subscribe(topic);
+                        client.subscribe(topic, offset);
                     }
                 } else if (command.substr(0, Message::kUnsubscribeCommand.size()) == Message::kUnsubscribeCommand) {
                     std::string topic = command.substr(12);
@@ -60,6 +78,8 @@ void handle_console_input(boost::asio::posix::stream_descriptor &input, PubSubCl
                     } else {
                         client.unsubscribe(topic);
                     }
+                } else if (command == Message::kStatsCommand) {
+                    client.stats();
                 } else if (command == Message::kHelpCommand) {
                     print_help();
                 } else {
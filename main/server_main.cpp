@@ -1,43 +1,168 @@
 #include <boost/asio.hpp>
 #include <boost/log/trivial.hpp>
-#include <boost/log/utility/setup/common_attributes.hpp>
-#include <boost/log/utility/setup/console.hpp>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "compression.h"
+#include "logging.h"
+#include "metrics_server.h"
 #include "pubsub_server.h"
 
-void init_logging(bool debug) {
-    boost::log::add_console_log(std::cout, boost::log::keywords::format = "%TimeStamp% [%Severity%]: %Message%");
-    boost::log::add_common_attributes();
-
-    const auto severity = debug ? boost::log::trivial::debug : boost::log::trivial::info;
-
-    boost::log::core::get()->set_filter(boost::log::trivial::severity >= severity);
-
-    if (debug) {
-        BOOST_LOG_TRIVIAL(debug) << "Debug mode enabled.\n";
+// Parse a positive byte or frame count, 0 on error
+std::size_t parse_limit(const std::string &value) {
+    try {
+        return std::stoull(value);
+    } catch (const std::exception &e) {
+        return 0;
     }
 }
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: server_app <port> [--debug]\n";
+        std::cerr << "Usage: server_app <port> [--debug] [--log-level <trace|debug|info|warning|error>]\n"
+                     "                  [--threads <count>]\n"
+                     "                  [--slow-consumer <drop-newest|drop-oldest|disconnect>]\n"
+                     "                  [--max-queued-bytes <bytes>] [--max-queued-frames <count>]\n"
+                     "                  [--topic-slow-consumer <topic> <policy>]\n"
+                     "                  [--log-dir <dir>] [--log-topic <topic>]... [--fsync <never|batch|interval>]\n"
+                     "                  [--fsync-interval-ms <ms>] [--retain-bytes <bytes>]\n"
+                     "                  [--metrics-port <port>] [--metrics-topics <count>]\n"
+                     "                  [--log-rate <records-per-second>] [--unix-socket <path>]\n"
+                     "                  [--shm-spin-us <us>] [--compress-bytes <bytes|off>]\n";
         return 1;
     }
 
-    bool debug{false};
+    auto log_level{boost::log::trivial::info};
+    std::size_t log_rate{pubsub::logging::kDefaultMaxRecordsPerSecond};
+    int threads{1};
+    pubsub::OutboundLimits limits;
+    std::vector<std::pair<std::string, pubsub::SlowConsumerPolicy>> topic_policies;
+    pubsub::MessageLog::Options log_options;
+    std::vector<std::string> logged_topics;
+    std::size_t retain_bytes{0};
+    unsigned short metrics_port{0};
+    std::size_t metrics_topics{pubsub::server::MetricsServer::kDefaultTopTopics};
+    std::string unix_socket;
+    std::chrono::microseconds shm_spin{0};
+    std::size_t compress_bytes{pubsub::compression::kDefaultThreshold};
 
-    // Check for debug flag
-    if (argc > 2) {
-        std::string debug_flag = argv[2];
-        if (debug_flag == "--debug") {
-            debug = true;
+    // Check for optional flags
+    for (int i = 2; i < argc; ++i) {
+        std::string flag = argv[i];
+        if (flag == "--debug") {
+            log_level = boost::log::trivial::debug;
+        } else if (flag == "--log-level" && i + 1 < argc) {
+            const auto level = pubsub::logging::parse_level(argv[++i]);
+            if (!level) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid log level.\n";
+                return 1;
+            }
+            log_level = *level;
+        } else if (flag == "--threads" && i + 1 < argc) {
+            try {
+                threads = std::stoi(argv[++i]);
+            } catch (const std::exception &e) {
+                threads = 0;
+            }
+            if (threads < 1) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid thread count.\n";
+                return 1;
+            }
+        } else if (flag == "--slow-consumer" && i + 1 < argc) {
+            const auto policy = pubsub::parse_slow_consumer_policy(argv[++i]);
+            if (!policy) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid slow consumer policy.\n";
+                return 1;
+            }
+            limits.policy = *policy;
+        } else if (flag == "--max-queued-bytes" && i + 1 < argc) {
+            limits.max_bytes = parse_limit(argv[++i]);
+            if (limits.max_bytes == 0) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid queued bytes limit.\n";
+                return 1;
+            }
+        } else if (flag == "--max-queued-frames" && i + 1 < argc) {
+            limits.max_frames = parse_limit(argv[++i]);
+            if (limits.max_frames == 0) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid queued frames limit.\n";
+                return 1;
+            }
+        } else if (flag == "--topic-slow-consumer" && i + 2 < argc) {
+            const std::string topic = argv[++i];
+            const auto policy = pubsub::parse_slow_consumer_policy(argv[++i]);
+            if (!policy) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid slow consumer policy for topic " << topic << ".\n";
+                return 1;
+            }
+            topic_policies.emplace_back(topic, *policy);
+        } else if (flag == "--log-dir" && i + 1 < argc) {
+            log_options.directory = argv[++i];
+        } else if (flag == "--log-topic" && i + 1 < argc) {
+            logged_topics.emplace_back(argv[++i]);
+        } else if (flag == "--fsync" && i + 1 < argc) {
+            const auto policy = pubsub::parse_fsync_policy(argv[++i]);
+            if (!policy) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid fsync policy.\n";
+                return 1;
+            }
+            log_options.fsync = *policy;
+        } else if (flag == "--fsync-interval-ms" && i + 1 < argc) {
+            const auto interval = parse_limit(argv[++i]);
+            if (interval == 0) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid fsync interval.\n";
+                return 1;
+            }
+            log_options.fsync_interval = std::chrono::milliseconds(interval);
+        } else if (flag == "--retain-bytes" && i + 1 < argc) {
+            retain_bytes = parse_limit(argv[++i]);
+            if (retain_bytes == 0) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid retained budget.\n";
+                return 1;
+            }
+        } else if (flag == "--metrics-port" && i + 1 < argc) {
+            const auto value = parse_limit(argv[++i]);
+            if (value == 0 || value > UINT16_MAX) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid metrics port.\n";
+                return 1;
+            }
+            metrics_port = static_cast<unsigned short>(value);
+        } else if (flag == "--metrics-topics" && i + 1 < argc) {
+            metrics_topics = parse_limit(argv[++i]);
+            if (metrics_topics == 0) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid metrics topic count.\n";
+                return 1;
+            }
+        } else if (flag == "--unix-socket" && i + 1 < argc) {
+            unix_socket = argv[++i];
+        } else if (flag == "--shm-spin-us" && i + 1 < argc) {
+            shm_spin = std::chrono::microseconds(parse_limit(argv[++i]));
+        } else if (flag == "--compress-bytes" && i + 1 < argc) {
+            const std::string value = argv[++i];
+            if (value != "off") {
+                compress_bytes = parse_limit(value);
+                if (compress_bytes == 0) {
+                    BOOST_LOG_TRIVIAL(error) << "Invalid compression threshold.\n";
+                    return 1;
+                }
+            } else {
+                compress_bytes = 0;
+            }
+        } else if (flag == "--log-rate" && i + 1 < argc) {
+            log_rate = parse_limit(argv[++i]);
+            if (log_rate == 0) {
+                BOOST_LOG_TRIVIAL(error) << "Invalid log rate.\n";
+                return 1;
+            }
         } else {
-            BOOST_LOG_TRIVIAL(error) << "Unknown argument: " << debug_flag << "\n";
+            BOOST_LOG_TRIVIAL(error) << "Unknown argument: " << flag << "\n";
             return 1;
         }
     }
 
-    init_logging(debug);
+    pubsub::logging::init(log_level, log_rate);
 
     short port{0};
 
@@ -48,8 +173,88 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    boost::asio::io_context io_context;
-    pubsub::server::PubSubServer server(io_context, port);
-    io_context.run();
+    if (!logged_topics.empty() && log_options.directory.empty()) {
+        BOOST_LOG_TRIVIAL(error) << "--log-topic needs a --log-dir.\n";
+        return 1;
+    }
+    // Outlives the servers, their connections may still be replaying from it
+    std::unique_ptr<pubsub::MessageLog> message_log;
+    if (!log_options.directory.empty()) {
+        message_log = std::make_unique<pubsub::MessageLog>(log_options);
+    }
+
+    // Per topic overrides keep the server wide high-water marks
+    const auto configure = [&](pubsub::TopicManager &topic_manager) {
+        topic_manager.set_default_limits(limits);
+        topic_manager.set_retained_budget(retain_bytes);
+        topic_manager.set_compression_threshold(compress_bytes);
+        for (const auto &[topic, policy] : topic_policies) {
+            auto topic_limits = limits;
+            topic_limits.policy = policy;
+            topic_manager.set_topic_limits(topic, topic_limits);
+        }
+        for (const auto &topic : logged_topics) {
+            if (!topic_manager.enable_log(topic, *message_log)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    if (threads == 1) {
+        boost::asio::io_context io_context;
+        pubsub::server::PubSubServer server(io_context, port);
+        if (!configure(server.topic_manager())) {
+            return 1;
+        }
+        if (!unix_socket.empty() && !server.listen_local(unix_socket)) {
+            return 1;
+        }
+        server.set_shared_memory_spin(shm_spin);
+        std::unique_ptr<pubsub::server::MetricsServer> metrics;
+        if (metrics_port != 0) {
+            metrics = std::make_unique<pubsub::server::MetricsServer>(io_context, metrics_port, server.stats(),
+                                                                      server.topic_manager(), metrics_topics);
+        }
+        io_context.run();
+        return 0;
+    }
+
+    // One io_context, acceptor and thread per worker, connections stay on the worker that accepted them
+    auto topic_manager = std::make_shared<pubsub::TopicManager>();
+    if (!configure(*topic_manager)) {
+        return 1;
+    }
+    auto stats = std::make_shared<pubsub::ServerStats>();
+    std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts;
+    std::vector<std::unique_ptr<pubsub::server::PubSubServer>> servers;
+    for (int i = 0; i < threads; ++i) {
+        io_contexts.push_back(std::make_unique<boost::asio::io_context>(1));
+        servers.push_back(
+            std::make_unique<pubsub::server::PubSubServer>(*io_contexts.back(), port, topic_manager, stats));
+    }
+
+    // Local clients and scrapes are served by the first worker
+    if (!unix_socket.empty() && !servers.front()->listen_local(unix_socket)) {
+        return 1;
+    }
+    servers.front()->set_shared_memory_spin(shm_spin);
+    std::unique_ptr<pubsub::server::MetricsServer> metrics;
+    if (metrics_port != 0) {
+        metrics = std::make_unique<pubsub::server::MetricsServer>(*io_contexts.front(), metrics_port, *stats,
+                                                                  *topic_manager, metrics_topics);
+    }
+
+    BOOST_LOG_TRIVIAL(info) << "[server] Running " << threads << " worker threads";
+
+    std::vector<std::thread> workers;
+    for (auto &io_context : io_contexts) {
+        workers.emplace_back([&io_context]() {
+            io_context->run();
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
     return 0;
 }
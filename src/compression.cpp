@@ -0,0 +1,73 @@
+#include "compression.h"
+
+#include <zlib.h>
+#include <cstdint>
+#include "message.h"
+
+namespace pubsub::compression {
+
+// Inflated data is forwarded as is to subscribers that did not ask for compression
+static_assert(kMaxInflatedBytes <= Message::kMaxDataSize, "inflated payloads must fit in a frame");
+
+namespace {
+
+constexpr std::size_t kSizeBytes{4};
+// Deflate never expands data by more than this, a larger claim is a lie
+constexpr std::size_t kMaxRatio{1032};
+
+template <typename String>
+bool compress_to(std::string_view data, String &out) {
+    if (data.size() > UINT32_MAX) {
+        out.clear();
+        return false;
+    }
+
+    out.resize(kSizeBytes + compressBound(static_cast<uLong>(data.size())));
+    const auto size = static_cast<std::uint32_t>(data.size());
+    out[0] = static_cast<char>(size >> 24);
+    out[1] = static_cast<char>(size >> 16);
+    out[2] = static_cast<char>(size >> 8);
+    out[3] = static_cast<char>(size);
+
+    // Fastest level, this runs on the publish path
+    auto compressed = static_cast<uLongf>(out.size() - kSizeBytes);
+    const int result = compress2(reinterpret_cast<Bytef *>(out.data() + kSizeBytes), &compressed,
+                                 reinterpret_cast<const Bytef *>(data.data()), static_cast<uLong>(data.size()),
+                                 Z_BEST_SPEED);
+    if (result != Z_OK || kSizeBytes + compressed >= data.size()) {
+        out.clear();
+        return false;
+    }
+    out.resize(kSizeBytes + compressed);
+    return true;
+}
+
+}  // namespace
+
+bool compress(std::string_view data, std::string &out) {
+    return compress_to(data, out);
+}
+
+bool decompress(std::string_view data, std::string &out) {
+    if (data.size() < kSizeBytes) {
+        return false;
+    }
+    const std::size_t size = static_cast<std::size_t>(static_cast<unsigned char>(data[0])) << 24 |
+                             static_cast<std::size_t>(static_cast<unsigned char>(data[1])) << 16 |
+                             static_cast<std::size_t>(static_cast<unsigned char>(data[2])) << 8 |
+                             static_cast<std::size_t>(static_cast<unsigned char>(data[3]));
+    // Checked before sizing `out`, so a small payload can not make it huge
+    if (size > kMaxInflatedBytes || size > (data.size() - kSizeBytes) * kMaxRatio) {
+        return false;
+    }
+
+    out.resize(size);
+    auto inflated = static_cast<uLongf>(size);
+    const int result = uncompress(reinterpret_cast<Bytef *>(out.data()), &inflated,
+                                  reinterpret_cast<const Bytef *>(data.data() + kSizeBytes),
+                                  static_cast<uLong>(data.size() - kSizeBytes));
+    // A stream ending early would leave part of `out` unwritten
+    return result == Z_OK && inflated == size;
+}
+
+}  // namespace pubsub::compression
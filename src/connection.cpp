@@ -0,0 +1,375 @@
+#include "connection.h"
+#include <boost/log/trivial.hpp>
+#include <cstring>
+#include <span>
+#include <utility>
+#include "logging.h"
+#include "spawn.h"
+
+namespace pubsub {
+
+namespace {
+
+std::string describe_peer(Connection::Socket &socket) {
+    boost::system::error_code ec;
+    const auto remote = socket.remote_endpoint(ec);
+    if (ec) {
+        return {};
+    }
+
+    const int family = remote.protocol().family();
+    if (family == AF_INET || family == AF_INET6) {
+        boost::asio::ip::tcp::endpoint endpoint;
+        std::memcpy(endpoint.data(), remote.data(), remote.size());
+        endpoint.resize(remote.size());
+        return endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
+    }
+    if (family == AF_UNIX) {
+        // Connecting sockets are unnamed, the listening path tells more
+        const auto local = socket.local_endpoint(ec);
+        if (!ec) {
+            boost::asio::local::stream_protocol::endpoint endpoint;
+            std::memcpy(endpoint.data(), local.data(), local.size());
+            endpoint.resize(local.size());
+            return "unix:" + endpoint.path();
+        }
+    }
+    return {};
+}
+
+}  // namespace
+
+Connection::Connection(Socket socket, std::shared_ptr<TrafficCounters> traffic)
+    : socket_(std::move(socket)),
+      owner_(*socket_.get_executor().target<boost::asio::io_context::executor_type>()),
+      traffic_(std::move(traffic)),
+      peer_(describe_peer(socket_)),
+      wake_(owner_) {}
+
+Connection::Socket &Connection::socket() {
+    return socket_;
+}
+
+bool Connection::is_open() const {
+    return socket_.is_open();
+}
+
+const std::string &Connection::peer() const {
+    return peer_;
+}
+
+ProtocolVersion Connection::protocol() const {
+    return protocol_.load(std::memory_order_relaxed);
+}
+
+void Connection::set_protocol(ProtocolVersion protocol) {
+    protocol_.store(protocol, std::memory_order_relaxed);
+}
+
+bool Connection::compression() const {
+    return compression_.load(std::memory_order_relaxed);
+}
+
+void Connection::set_compression(bool enabled) {
+    compression_.store(enabled, std::memory_order_relaxed);
+}
+
+void Connection::set_topic_alias(std::uint32_t alias, std::uint32_t topic_id) {
+    if (alias >= topic_aliases_.size()) {
+        topic_aliases_.resize(alias + 1, kNoTopicAlias);
+    }
+    topic_aliases_[alias] = topic_id;
+}
+
+bool Connection::topic_alias(std::uint32_t alias, std::uint32_t &topic_id) const {
+    if (alias >= topic_aliases_.size() || topic_aliases_[alias] == kNoTopicAlias) {
+        return false;
+    }
+    topic_id = topic_aliases_[alias];
+    return true;
+}
+
+std::vector<std::uint32_t> Connection::clear_topic_aliases() {
+    std::vector<std::uint32_t> topic_ids;
+    for (const auto topic_id : topic_aliases_) {
+        if (topic_id != kNoTopicAlias) {
+            topic_ids.push_back(topic_id);
+        }
+    }
+    topic_aliases_.clear();
+    return topic_ids;
+}
+
+void Connection::send(FrameSPtr frame) {
+    if (owner_.running_in_this_thread()) {
+        enqueue(std::move(frame));
+        return;
+    }
+
+    // Published from another worker, hop over to the thread owning the socket
+    auto deliver = [self = shared_from_this(), frame = std::move(frame)]() mutable {
+        self->enqueue(std::move(frame));
+    };
+    boost::asio::post(owner_, bind_memory(send_memory_, std::move(deliver)));
+}
+
+void Connection::send(FrameSPtr frame, const OutboundLimits &limits, SlowConsumerCounters &counters) {
+    if (owner_.running_in_this_thread()) {
+        enqueue_limited(std::move(frame), limits, counters);
+        return;
+    }
+
+    auto deliver = [self = shared_from_this(), frame = std::move(frame), limits, &counters]() mutable {
+        self->enqueue_limited(std::move(frame), limits, counters);
+    };
+    boost::asio::post(owner_, bind_memory(send_memory_, std::move(deliver)));
+}
+
+void Connection::enqueue_limited(FrameSPtr frame, const OutboundLimits &limits, SlowConsumerCounters &counters) {
+    const auto over_limit = [&]() {
+        return outbound_.size() + 1 > limits.max_frames || queued_bytes() + frame->size() > limits.max_bytes;
+    };
+
+    if (!socket_.is_open() || !over_limit()) {
+        enqueue(std::move(frame));
+        return;
+    }
+
+    switch (limits.policy) {
+        case SlowConsumerPolicy::DROP_NEWEST:
+            counters.dropped_newest.fetch_add(1, std::memory_order_relaxed);
+            PUBSUB_LOG(trace) << "[connection] Outbound queue full, dropping newest frame";
+            return;
+
+        case SlowConsumerPolicy::DROP_OLDEST: {
+            // Frames being written can not be taken back, evict the ones after them
+            auto first = outbound_.begin() + in_flight_;
+            auto last = first;
+            std::size_t frames = outbound_.size();
+            std::size_t bytes = queued_bytes();
+            while (last != outbound_.end() &&
+                   (frames + 1 > limits.max_frames || bytes + frame->size() > limits.max_bytes)) {
+                bytes -= (*last)->size();
+                --frames;
+                ++last;
+            }
+            const auto dropped = static_cast<std::uint64_t>(last - first);
+            drop_queued(first, last);
+            counters.dropped_oldest.fetch_add(dropped, std::memory_order_relaxed);
+            PUBSUB_LOG(trace) << "[connection] Outbound queue full, dropped " << dropped << " oldest frames";
+            if (over_limit()) {
+                // Only frames in flight left, the new one does not fit either
+                counters.dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            enqueue(std::move(frame));
+            return;
+        }
+
+        case SlowConsumerPolicy::DISCONNECT:
+            counters.disconnects.fetch_add(1, std::memory_order_relaxed);
+            BOOST_LOG_TRIVIAL(warning) << "[connection] Outbound queue full, disconnecting slow subscriber";
+            // The pending read fails and runs the regular disconnect path
+            close();
+            return;
+    }
+}
+
+void Connection::enqueue(FrameSPtr frame) {
+    if (!socket_.is_open()) {
+        PUBSUB_LOG(trace) << "[connection] Socket is closed, dropping frame";
+        return;
+    }
+
+    if (traffic_) {
+        add_local(traffic_->queued_frames);
+        add_local(traffic_->queued_bytes, frame->size());
+    }
+    queued_bytes_.store(queued_bytes() + frame->size(), std::memory_order_relaxed);
+    outbound_.push_back(std::move(frame));
+    queued_frames_.store(outbound_.size(), std::memory_order_relaxed);
+
+    // A write already in progress picks up the new frame on completion
+    if (in_flight_ == 0) {
+        start_write();
+    }
+}
+
+std::size_t Connection::queue_depth() const {
+    return queued_frames_.load(std::memory_order_relaxed);
+}
+
+std::size_t Connection::queued_bytes() const {
+    return queued_bytes_.load(std::memory_order_relaxed);
+}
+
+void Connection::drop_queued(std::deque<FrameSPtr>::iterator first, std::deque<FrameSPtr>::iterator last) {
+    std::size_t bytes = queued_bytes();
+    for (auto it = first; it != last; ++it) {
+        bytes -= (*it)->size();
+    }
+    if (traffic_) {
+        sub_local(traffic_->queued_frames, static_cast<std::uint64_t>(last - first));
+        sub_local(traffic_->queued_bytes, queued_bytes() - bytes);
+    }
+    outbound_.erase(first, last);
+    queued_bytes_.store(bytes, std::memory_order_relaxed);
+    queued_frames_.store(outbound_.size(), std::memory_order_relaxed);
+}
+
+void Connection::on_drained(std::function<void()> callback) {
+    drained_ = std::move(callback);
+    notify_drained();
+}
+
+void Connection::notify_drained() {
+    if (drained_ && outbound_.empty()) {
+        boost::asio::post(owner_, std::exchange(drained_, nullptr));
+    }
+}
+
+void Connection::close() {
+    drained_ = nullptr;
+    // Frames handed to async_write must stay alive until its handler runs
+    drop_queued(outbound_.begin() + in_flight_, outbound_.end());
+    // An idle write loop finds the socket closed and ends
+    wake_.cancel();
+
+    if (socket_.is_open()) {
+        boost::system::error_code ec;
+        socket_.shutdown(Socket::shutdown_both, ec);
+        if (ec) {
+            BOOST_LOG_TRIVIAL(error) << "[connection] Error shutting down socket: " << ec.message();
+        }
+        socket_.close(ec);
+        if (ec) {
+            BOOST_LOG_TRIVIAL(error) << "[connection] Error closing socket: " << ec.message();
+        }
+    }
+}
+
+bool Connection::attach(std::unique_ptr<ShmChannel> channel) {
+    if (channel_ || in_flight_ != 0 || !outbound_.empty()) {
+        return false;
+    }
+    channel_ = std::move(channel);
+    return true;
+}
+
+ShmChannel *Connection::channel() const {
+    return channel_.get();
+}
+
+bool Connection::write_pending() const {
+    return !outbound_.empty();
+}
+
+void Connection::resume() {
+    if (channel_ && !outbound_.empty()) {
+        write_ring();
+    }
+}
+
+void Connection::start_write() {
+    if (channel_) {
+        write_ring();
+        return;
+    }
+
+    // Gather everything queued so far into a single write
+    write_buffers_.clear();
+    for (const auto &frame : outbound_) {
+        write_buffers_.push_back(boost::asio::buffer(*frame));
+    }
+    in_flight_ = outbound_.size();
+    if (traffic_ && traffic_->timing.load(std::memory_order_relaxed)) {
+        write_started_ = std::chrono::steady_clock::now();
+    }
+
+    if (!writer_started_) {
+        writer_started_ = true;
+        boost::asio::co_spawn(owner_, write_loop(shared_from_this()), rethrow_on_error);
+    } else {
+        wake_.cancel();
+    }
+}
+
+boost::asio::awaitable<void> Connection::write_loop([[maybe_unused]] std::shared_ptr<Connection> keep_alive) {
+    // `keep_alive` keeps the connection alive until the socket is closed
+    boost::system::error_code error;
+    while (socket_.is_open()) {
+        if (in_flight_ == 0) {
+            wake_.expires_at(boost::asio::steady_timer::time_point::max());
+            co_await wake_.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            continue;
+        }
+        // Through a span, the operation would copy a vector
+        const std::size_t bytes = co_await boost::asio::async_write(
+            socket_, std::span<const boost::asio::const_buffer>(write_buffers_),
+            boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        handle_write(error, bytes);
+    }
+}
+
+void Connection::handle_write(const boost::system::error_code &error, std::size_t bytes_transferred) {
+    if (traffic_) {
+        if (write_started_ != std::chrono::steady_clock::time_point()) {
+            traffic_->write.record(std::chrono::steady_clock::now() - write_started_);
+            write_started_ = {};
+        }
+        add_local(traffic_->bytes_out, bytes_transferred);
+        if (!error) {
+            add_local(traffic_->frames_out, in_flight_);
+        } else if (error != boost::asio::error::operation_aborted) {
+            add_local(traffic_->write_errors);
+        }
+    }
+    drop_queued(outbound_.begin(), outbound_.begin() + in_flight_);
+    in_flight_ = 0;
+
+    if (error) {
+        if (error != boost::asio::error::operation_aborted) {
+            BOOST_LOG_TRIVIAL(warning) << "[connection] Write failed: " << error.message();
+        }
+        // The pending read fails as well and runs the regular disconnect path
+        drop_queued(outbound_.begin(), outbound_.end());
+        close();
+        return;
+    }
+
+    if (!outbound_.empty()) {
+        start_write();
+    }
+    notify_drained();
+}
+
+void Connection::write_ring() {
+    auto &ring = channel_->outbound();
+    std::size_t bytes{0};
+    std::size_t frames{0};
+    for (const auto &frame : outbound_) {
+        const auto written = ring.write(frame->data() + front_written_, frame->size() - front_written_);
+        bytes += written;
+        front_written_ += written;
+        if (front_written_ < frame->size()) {
+            // Ring is full, the client rings the doorbell once it made room
+            break;
+        }
+        front_written_ = 0;
+        ++frames;
+    }
+    drop_queued(outbound_.begin(), outbound_.begin() + static_cast<std::ptrdiff_t>(frames));
+    // The slow consumer policy must not evict a frame the client has part of
+    in_flight_ = front_written_ != 0 ? 1 : 0;
+
+    if (traffic_) {
+        add_local(traffic_->bytes_out, bytes);
+        add_local(traffic_->frames_out, frames);
+    }
+    if (bytes != 0) {
+        channel_->notify_peer(socket_.native_handle());
+    }
+    notify_drained();
+}
+
+}  // namespace pubsub
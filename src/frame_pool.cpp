@@ -0,0 +1,22 @@
+#include "frame_pool.h"
+
+namespace pubsub {
+
+namespace {
+
+std::pmr::memory_resource *frame_pool() {
+    // Never destroyed, connections may still hold frames while static objects go away
+    static auto *pool = new std::pmr::synchronized_pool_resource(std::pmr::pool_options{0, kMaxPooledFrameBytes});
+    return pool;
+}
+
+}  // namespace
+
+FrameSPtr make_frame(const MessageView &message, ProtocolVersion protocol) {
+    // The frame is constructed with the same allocator, its bytes come from the pool as well
+    auto frame = std::allocate_shared<Frame>(std::pmr::polymorphic_allocator<Frame>(frame_pool()));
+    message.serialize_to(*frame, protocol);
+    return frame;
+}
+
+}  // namespace pubsub
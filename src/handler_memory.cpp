@@ -0,0 +1,21 @@
+#include "handler_memory.h"
+#include <new>
+
+namespace pubsub {
+
+void *HandlerMemory::allocate(std::size_t size) {
+    if (size <= kSize && !in_use_.exchange(true, std::memory_order_acquire)) {
+        return storage_;
+    }
+    return ::operator new(size);
+}
+
+void HandlerMemory::deallocate(void *pointer) {
+    if (pointer == storage_) {
+        in_use_.store(false, std::memory_order_release);
+        return;
+    }
+    ::operator delete(pointer);
+}
+
+}  // namespace pubsub
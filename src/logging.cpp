@@ -0,0 +1,117 @@
+#include "logging.h"
+
+#include <boost/core/null_deleter.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/async_frontend.hpp>
+#include <boost/log/sinks/text_ostream_backend.hpp>
+#include <boost/log/support/date_time.hpp>
+#include <boost/log/utility/setup/common_attributes.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+namespace pubsub::logging {
+
+namespace {
+
+using Sink = boost::log::sinks::asynchronous_sink<boost::log::sinks::text_ostream_backend>;
+
+// Fixed one second windows. Checked by the sink filter on the thread emitting
+// the record, before it is formatted or queued, so a dropped record costs that
+// thread a couple of atomic operations.
+class RateLimiter {
+public:
+    explicit RateLimiter(std::size_t max_per_second) : max_per_second_(max_per_second) {}
+
+    bool allow() {
+        const auto second = std::chrono::duration_cast<std::chrono::seconds>(
+                                std::chrono::steady_clock::now().time_since_epoch())
+                                .count();
+        auto window = window_.load(std::memory_order_relaxed);
+        if (second != window && window_.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+            count_.store(0, std::memory_order_relaxed);
+        }
+        if (count_.fetch_add(1, std::memory_order_relaxed) < max_per_second_) {
+            return true;
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Records dropped since the last call
+    std::uint64_t take_dropped() {
+        return dropped_.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    const std::size_t max_per_second_;
+    std::atomic<std::int64_t> window_{0};
+    std::atomic<std::size_t> count_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+};
+
+boost::shared_ptr<Sink> sink;
+std::unique_ptr<RateLimiter> limiter;
+std::once_flag at_exit;
+
+}  // namespace
+
+void init(boost::log::trivial::severity_level level, std::size_t max_records_per_second) {
+    namespace expr = boost::log::expressions;
+
+    // Called again, the new sink replaces the old one
+    shutdown();
+    limiter = std::make_unique<RateLimiter>(max_records_per_second);
+
+    sink = boost::make_shared<Sink>();
+    sink->locked_backend()->add_stream(boost::shared_ptr<std::ostream>(&std::cout, boost::null_deleter()));
+    sink->locked_backend()->auto_flush(true);
+    sink->set_formatter([](const boost::log::record_view &record, boost::log::formatting_ostream &stream) {
+        // Runs on the sink thread for records that got through
+        if (const auto dropped = limiter->take_dropped(); dropped > 0) {
+            stream << "[" << dropped << " log records dropped] ";
+        }
+        stream << boost::log::extract<boost::posix_time::ptime>("TimeStamp", record) << " ["
+               << record[boost::log::trivial::severity] << "]: " << record[expr::smessage];
+    });
+
+    sink->set_filter([level](const boost::log::attribute_value_set &attributes) {
+        const auto severity = attributes[boost::log::trivial::severity];
+        return severity && *severity >= level && (*severity >= boost::log::trivial::fatal || limiter->allow());
+    });
+
+    boost::log::add_common_attributes();
+    boost::log::core::get()->add_sink(sink);
+    std::call_once(at_exit, []() { std::atexit(shutdown); });
+
+    if (level <= boost::log::trivial::debug) {
+        BOOST_LOG_TRIVIAL(debug) << "Logging at " << level << " level.\n";
+    }
+    if (!compiled_in(level)) {
+        BOOST_LOG_TRIVIAL(warning) << "Logs below " << boost::log::trivial::PUBSUB_MIN_LOG_SEVERITY
+                                   << " are compiled out, build with -DPUBSUB_LOG_LEVEL=" << level << ".\n";
+    }
+}
+
+std::optional<boost::log::trivial::severity_level> parse_level(std::string_view name) {
+    boost::log::trivial::severity_level level;
+    if (!boost::log::trivial::from_string(name.data(), name.size(), level)) {
+        return std::nullopt;
+    }
+    return level;
+}
+
+void shutdown() {
+    if (!sink) {
+        return;
+    }
+    boost::log::core::get()->remove_sink(sink);
+    sink->stop();
+    sink->flush();
+    sink.reset();
+}
+
+}  // namespace pubsub::logging
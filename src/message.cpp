@@ -1,69 +1,409 @@
 #include "message.h"
+#include "topic.h"
 
-#include <boost/log/trivial.hpp>
-#include <sstream>
+#include <charconv>
+#include <climits>
 
 namespace pubsub {
 
-// Serialize the message into a string with endl as delimiter
-std::string Message::serialize() const {
-    std::ostringstream oss;
-    switch (type) {
+namespace {
+
+template <typename String>
+void put_u16(String &out, std::uint16_t value) {
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+template <typename String>
+void put_u32(String &out, std::uint32_t value) {
+    put_u16(out, static_cast<std::uint16_t>(value >> 16));
+    put_u16(out, static_cast<std::uint16_t>(value));
+}
+
+std::uint16_t get_u16(std::string_view in, std::size_t pos) {
+    return static_cast<std::uint16_t>(static_cast<unsigned char>(in[pos]) << 8 |
+                                      static_cast<unsigned char>(in[pos + 1]));
+}
+
+std::uint32_t get_u32(std::string_view in, std::size_t pos) {
+    return static_cast<std::uint32_t>(get_u16(in, pos)) << 16 | get_u16(in, pos + 2);
+}
+
+template <typename String>
+void put_u64(String &out, std::uint64_t value) {
+    put_u32(out, static_cast<std::uint32_t>(value >> 32));
+    put_u32(out, static_cast<std::uint32_t>(value));
+}
+
+std::uint64_t get_u64(std::string_view in, std::size_t pos) {
+    return static_cast<std::uint64_t>(get_u32(in, pos)) << 32 | get_u32(in, pos + 4);
+}
+
+template <typename String>
+void serialize_binary(const MessageView &message, String &out) {
+    const bool aliased = message.alias != kNoTopicAlias;
+    const bool has_offset = message.offset != kNoOffset;
+    const std::size_t topic_size = message.topic.size() + (aliased ? 4 : 0) + (has_offset ? 8 : 0);
+
+    if (out.empty()) {
+        out.reserve(Message::kBinaryHeaderSize + topic_size + message.data.size());
+    }
+    out.push_back(static_cast<char>(message.type));
+    out.push_back(static_cast<char>((aliased ? Message::kFlagTopicAlias : 0) | (has_offset ? Message::kFlagOffset : 0) |
+                                    (message.compressed ? Message::kFlagCompressed : 0)));
+    put_u16(out, static_cast<std::uint16_t>(topic_size));
+    put_u32(out, static_cast<std::uint32_t>(message.data.size()));
+    if (aliased) {
+        put_u32(out, message.alias);
+    }
+    if (has_offset) {
+        put_u64(out, message.offset);
+    }
+    out.append(message.topic).append(message.data);
+}
+
+// Publishes need a concrete topic name, subscriptions a well formed filter. A
+// longer name would wrap the length of the binary frames it is forwarded in.
+bool is_valid_topic(const MessageView &msg) {
+    if (msg.topic.size() > Message::kMaxTopicSize) {
+        return false;
+    }
+    switch (msg.type) {
+        case MessageType::PUBLISH:
+            if (msg.alias != kNoTopicAlias) {
+                // Either defines the alias or publishes through it
+                return msg.alias <= Message::kMaxTopicAlias && (msg.topic.empty() || topic::is_valid_name(msg.topic));
+            }
+            return !msg.topic.empty() && topic::is_valid_name(msg.topic);
+        case MessageType::SUBSCRIBE:
+        case MessageType::UNSUBSCRIBE:
+            return topic::is_valid_filter(msg.topic);
+        default:
+            return true;
+    }
+}
+
+MessageView parse_binary(std::string_view frame) {
+    MessageView msg;
+    if (frame.size() < Message::kBinaryHeaderSize) {
+        return msg;
+    }
+
+    const auto type = static_cast<unsigned char>(frame[0]);
+    const auto flags = static_cast<unsigned char>(frame[1]);
+    std::size_t topic_size = get_u16(frame, 2);
+    const std::size_t data_size = get_u32(frame, 4);
+    if (frame.size() != Message::kBinaryHeaderSize + topic_size + data_size) {
+        return msg;
+    }
+
+    if (type < static_cast<unsigned char>(MessageType::UNKNOWN)) {
+        msg.type = static_cast<MessageType>(type);
+    }
+    msg.data = frame.substr(Message::kBinaryHeaderSize + topic_size, data_size);
+    msg.compressed = (flags & Message::kFlagCompressed) != 0;
+
+    std::size_t topic_pos = Message::kBinaryHeaderSize;
+    if (flags & Message::kFlagTopicAlias) {
+        if (topic_size < 4) {
+            msg.type = MessageType::UNKNOWN;
+            return msg;
+        }
+        msg.alias = get_u32(frame, topic_pos);
+        topic_pos += 4;
+        topic_size -= 4;
+    }
+    if (flags & Message::kFlagOffset) {
+        if (topic_size < 8) {
+            msg.type = MessageType::UNKNOWN;
+            return msg;
+        }
+        msg.offset = get_u64(frame, topic_pos);
+        topic_pos += 8;
+        topic_size -= 8;
+    }
+    msg.topic = frame.substr(topic_pos, topic_size);
+
+    if (!is_valid_topic(msg)) {
+        msg.type = MessageType::UNKNOWN;
+    }
+    return msg;
+}
+
+// Same character class as the stream extraction the text protocol was specified with
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// Skip whitespace, then return the next token and advance `pos` past it
+std::string_view next_token(std::string_view in, std::size_t &pos) {
+    while (pos < in.size() && is_space(in[pos])) {
+        ++pos;
+    }
+    const std::size_t begin = pos;
+    while (pos < in.size() && !is_space(in[pos])) {
+        ++pos;
+    }
+    return in.substr(begin, pos - begin);
+}
+
+// Capability names after the version, unknown ones are ignored so clients can
+// ask servers that do not know them yet
+std::uint8_t parse_capabilities(std::string_view frame, std::size_t pos) {
+    std::uint8_t capabilities{0};
+    for (auto token = next_token(frame, pos); !token.empty(); token = next_token(frame, pos)) {
+        if (token == Message::kCompressCapability) {
+            capabilities |= Message::kCapabilityCompression;
+        }
+    }
+    return capabilities;
+}
+
+bool parse_version(std::string_view token, ProtocolVersion &version) {
+    unsigned int value{0};
+    const auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+    if (result.ec != std::errc() || value == 0 || value > UINT8_MAX) {
+        return false;
+    }
+    version = static_cast<ProtocolVersion>(value);
+    return true;
+}
+
+// Map a command token to its type, dispatching on length first so at most
+// two full comparisons are made
+MessageType command_type(std::string_view command) {
+    switch (command.size()) {
+        case 3:
+            if (command == Message::kShmCommand) {
+                return MessageType::SHM;
+            }
+            break;
+        case 5:
+            if (command == Message::kStatsCommand) {
+                return MessageType::STATS;
+            }
+            break;
+        case 7:
+            if (command == Message::kPublishCommand) {
+                return MessageType::PUBLISH;
+            } else if (command == Message::kConnectCommand) {
+                return MessageType::CONNECT;
+            } else if (command == Message::kConnackCommand) {
+                return MessageType::CONNACK;
+            }
+            break;
+        case 9:
+            if (command == Message::kSubscribeCommand) {
+                return MessageType::SUBSCRIBE;
+            }
+            break;
+        case 10:
+            if (command == Message::kDisconnectCommand) {
+                return MessageType::DISCONNECT;
+            }
+            break;
+        case 11:
+            if (command == Message::kUnsubscribeCommand) {
+                return MessageType::UNSUBSCRIBE;
+            }
+            break;
+        default:
+            break;
+    }
+    return MessageType::UNKNOWN;
+}
+
+MessageView parse_text(std::string_view frame) {
+    MessageView msg;
+    std::size_t pos{0};
+    msg.type = command_type(next_token(frame, pos));
+
+    switch (msg.type) {
+        case MessageType::CONNECT:
+            msg.data = next_token(frame, pos);
+            parse_version(next_token(frame, pos), msg.version);
+            msg.capabilities = parse_capabilities(frame, pos);
+            break;
+        case MessageType::CONNACK:
+            if (!parse_version(next_token(frame, pos), msg.version)) {
+                msg.type = MessageType::UNKNOWN;
+            }
+            msg.capabilities = parse_capabilities(frame, pos);
+            break;
+        case MessageType::PUBLISH:
+            msg.topic = next_token(frame, pos);
+            if (pos < frame.size()) {
+                msg.data = frame.substr(pos + 1);  // Skip the separator after the topic
+            }
+            break;
+        case MessageType::SUBSCRIBE:
+            msg.topic = next_token(frame, pos);
+            if (const auto offset = next_token(frame, pos); !offset.empty()) {
+                // Optional replay offset, anything else than a number is an error
+                const auto result = std::from_chars(offset.data(), offset.data() + offset.size(), msg.offset);
+                if (result.ec != std::errc() || result.ptr != offset.data() + offset.size()) {
+                    msg.type = MessageType::UNKNOWN;
+                }
+            }
+            break;
+        case MessageType::UNSUBSCRIBE:
+            msg.topic = next_token(frame, pos);
+            break;
+        case MessageType::STATS:
+            if (pos < frame.size()) {
+                msg.data = frame.substr(pos + 1);
+            }
+            break;
+        case MessageType::SHM:
+            msg.data = next_token(frame, pos);
+            break;
+        default:
+            break;
+    }
+
+    if (!is_valid_topic(msg)) {
+        msg.type = MessageType::UNKNOWN;
+    }
+    return msg;
+}
+
+template <typename String>
+void append_capabilities(std::uint8_t capabilities, String &out) {
+    if (capabilities & Message::kCapabilityCompression) {
+        out.append(" ").append(Message::kCompressCapability);
+    }
+}
+
+// Text frame with endl as delimiter
+template <typename String>
+void serialize_text(const MessageView &message, String &out) {
+    if (out.empty()) {
+        // Command, two separators, topic, data and delimiter
+        out.reserve(Message::kUnsubscribeCommand.size() + message.topic.size() + message.data.size() + 3);
+    }
+
+    switch (message.type) {
         case MessageType::CONNECT:
-            oss << kConnectCommand << " " << data;
+            out.append(Message::kConnectCommand).append(" ").append(message.data);
+            if (message.version != ProtocolVersion::TEXT || message.capabilities != 0) {
+                out.append(" ").append(std::to_string(static_cast<int>(message.version)));
+            }
+            append_capabilities(message.capabilities, out);
+            break;
+        case MessageType::CONNACK:
+            out.append(Message::kConnackCommand).append(" ").append(std::to_string(static_cast<int>(message.version)));
+            append_capabilities(message.capabilities, out);
             break;
         case MessageType::DISCONNECT:
-            oss << kDisconnectCommand;
+            out.append(Message::kDisconnectCommand);
             break;
         case MessageType::PUBLISH:
-            oss << kPublishCommand << " " << topic << " " << data;
+            out.append(Message::kPublishCommand).append(" ").append(message.topic).append(" ").append(message.data);
             break;
         case MessageType::SUBSCRIBE:
-            oss << kSubscribeCommand << " " << topic;
+            out.append(Message::kSubscribeCommand).append(" ").append(message.topic);
+            if (message.offset != kNoOffset) {
+                out.append(" ").append(std::to_string(message.offset));
+            }
             break;
         case MessageType::UNSUBSCRIBE:
-            oss << kUnsubscribeCommand << " " << topic;
+            out.append(Message::kUnsubscribeCommand).append(" ").append(message.topic);
+            break;
+        case MessageType::STATS:
+            out.append(Message::kStatsCommand);
+            if (!message.data.empty()) {
+                out.append(" ").append(message.data);
+            }
+            break;
+        case MessageType::SHM:
+            out.append(Message::kShmCommand).append(" ").append(message.data);
             break;
         default:
-            oss << kUnknowndCommand;
+            out.append(Message::kUnknowndCommand);
             break;
     }
-    oss << kDelim;  // Add delimiter
-    return oss.str();
+    out.append(Message::kDelim);  // Add delimiter
 }
 
-// Deserialize a string into a Message object using endl as delimiter
-Message Message::deserialize(const std::string &message) {
-    Message msg;
-    std::istringstream iss(message);
-    std::string command;
-    iss >> command;
-
-    if (command == kConnectCommand) {
-        msg.type = MessageType::CONNECT;
-        iss >> msg.data;
-    } else if (command == kDisconnectCommand) {
-        msg.type = MessageType::DISCONNECT;
-    } else if (command == kPublishCommand) {
-        msg.type = MessageType::PUBLISH;
-        iss >> msg.topic;
-        if (msg.topic.empty()) {
-            msg.type = MessageType::UNKNOWN;
-        } else {
-            std::getline(iss, msg.data);  // Read the rest of the line as data
-            msg.data.erase(0, 1);         // Remove leading space
-        }
-    } else if (command == kSubscribeCommand) {
-        msg.type = MessageType::SUBSCRIBE;
-        iss >> msg.topic;
-    } else if (command == kUnsubscribeCommand) {
-        msg.type = MessageType::UNSUBSCRIBE;
-        iss >> msg.topic;
+}  // namespace
+
+std::string MessageView::serialize(ProtocolVersion protocol) const {
+    std::string out;
+    serialize_to(out, protocol);
+    return out;
+}
+
+void MessageView::serialize_to(std::string &out, ProtocolVersion protocol) const {
+    if (protocol == ProtocolVersion::BINARY) {
+        serialize_binary(*this, out);
     } else {
-        msg.type = MessageType::UNKNOWN;
+        serialize_text(*this, out);
+    }
+}
+
+void MessageView::serialize_to(std::pmr::string &out, ProtocolVersion protocol) const {
+    if (protocol == ProtocolVersion::BINARY) {
+        serialize_binary(*this, out);
+    } else {
+        serialize_text(*this, out);
     }
+}
+
+MessageView MessageView::parse(std::string_view frame, ProtocolVersion protocol) {
+    return protocol == ProtocolVersion::BINARY ? parse_binary(frame) : parse_text(frame);
+}
 
+MessageView Message::view() const {
+    return MessageView{type, topic, data, version, alias, offset, capabilities, compressed};
+}
+
+std::string Message::serialize(ProtocolVersion protocol) const {
+    return view().serialize(protocol);
+}
+
+// Deserialize a string into an owning Message object
+Message Message::deserialize(std::string_view message, ProtocolVersion protocol) {
+    const MessageView view = MessageView::parse(message, protocol);
+
+    Message msg;
+    msg.type = view.type;
+    msg.topic = view.topic;
+    msg.data = view.data;
+    msg.version = view.version;
+    msg.alias = view.alias;
+    msg.offset = view.offset;
+    msg.capabilities = view.capabilities;
+    msg.compressed = view.compressed;
     return msg;
 }
 
+std::size_t Message::next_frame(std::string_view buffer, ProtocolVersion protocol, std::string_view &frame) {
+    if (protocol == ProtocolVersion::BINARY) {
+        // The header tells the frame size, no need to scan for a delimiter
+        if (buffer.size() < kBinaryHeaderSize) {
+            return 0;
+        }
+        const std::size_t size = kBinaryHeaderSize + get_u16(buffer, 2) + get_u32(buffer, 4);
+        // Told by the header, before any of the frame is buffered
+        if (size > kMaxFrameSize) {
+            return kFrameTooLarge;
+        }
+        if (buffer.size() < size) {
+            return 0;
+        }
+        frame = buffer.substr(0, size);
+        return size;
+    }
+
+    const std::size_t delimiter_pos = buffer.find(kDelim);
+    if (delimiter_pos == std::string_view::npos) {
+        return buffer.size() > kMaxFrameSize ? kFrameTooLarge : 0;
+    }
+    if (delimiter_pos > kMaxFrameSize) {
+        return kFrameTooLarge;
+    }
+    frame = buffer.substr(0, delimiter_pos);
+    return delimiter_pos + kDelim.size();
+}
+
 }  // namespace pubsub
@@ -0,0 +1,516 @@
+#include "message_log.h"
+#include <boost/log/trivial.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+
+namespace pubsub {
+
+namespace {
+
+constexpr std::size_t kRecordHeaderSize{12};
+constexpr std::string_view kSegmentSuffix{".log"};
+
+void put_u32(std::string &out, std::uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>(value >> shift));
+    }
+}
+
+void put_u64(std::string &out, std::uint64_t value) {
+    put_u32(out, static_cast<std::uint32_t>(value >> 32));
+    put_u32(out, static_cast<std::uint32_t>(value));
+}
+
+std::uint64_t get_be(std::string_view in, std::size_t pos, std::size_t size) {
+    std::uint64_t value{0};
+    for (std::size_t i = 0; i < size; ++i) {
+        value = value << 8 | static_cast<unsigned char>(in[pos + i]);
+    }
+    return value;
+}
+
+// Call `callback` for every complete record in `bytes`, returns the length of
+// the complete records so a torn tail can be cut off
+template <typename Callback>
+std::size_t scan_records(std::string_view bytes, Callback &&callback) {
+    std::size_t pos{0};
+    while (bytes.size() - pos >= kRecordHeaderSize) {
+        const std::uint64_t offset = get_be(bytes, pos, 8);
+        const std::size_t size = get_be(bytes, pos + 8, 4);
+        if (bytes.size() - pos - kRecordHeaderSize < size) {
+            break;
+        }
+        if (!callback(offset, bytes.substr(pos + kRecordHeaderSize, size))) {
+            break;
+        }
+        pos += kRecordHeaderSize + size;
+    }
+    return pos;
+}
+
+// Read only mapping of a whole segment file
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path &path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            BOOST_LOG_TRIVIAL(error) << "[message_log] Can not open " << path << ": " << std::strerror(errno);
+            return;
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED) {
+                data_ = static_cast<const char *>(data);
+                size_ = st.st_size;
+            } else {
+                BOOST_LOG_TRIVIAL(error) << "[message_log] Can not map " << path << ": " << std::strerror(errno);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data_) {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::string_view bytes() const {
+        return std::string_view(data_, size_);
+    }
+
+private:
+    const char *data_{nullptr};
+    std::size_t size_{0};
+};
+
+// Topic names may contain characters file systems do not like, keep only the
+// unambiguous ones and percent encode the rest
+std::string directory_name(std::string_view topic) {
+    static constexpr char kHex[] = "0123456789ABCDEF";
+    std::string name;
+    for (const char c : topic) {
+        const auto byte = static_cast<unsigned char>(c);
+        if (std::isalnum(byte) || c == '-' || c == '_') {
+            name.push_back(c);
+        } else {
+            name.push_back('%');
+            name.push_back(kHex[byte >> 4]);
+            name.push_back(kHex[byte & 0x0F]);
+        }
+    }
+    return name;
+}
+
+std::filesystem::path segment_path(const std::filesystem::path &directory, std::uint64_t base_offset) {
+    std::string name = std::to_string(base_offset);
+    name.insert(0, 20 - name.size(), '0');
+    return directory / name.append(kSegmentSuffix);
+}
+
+bool write_all(int fd, std::string_view bytes) {
+    while (!bytes.empty()) {
+        const ssize_t written = ::write(fd, bytes.data(), bytes.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes.remove_prefix(written);
+    }
+    return true;
+}
+
+}  // namespace
+
+std::optional<FsyncPolicy> parse_fsync_policy(std::string_view name) {
+    if (name == "never") {
+        return FsyncPolicy::NEVER;
+    } else if (name == "batch") {
+        return FsyncPolicy::BATCH;
+    } else if (name == "interval") {
+        return FsyncPolicy::INTERVAL;
+    }
+    return std::nullopt;
+}
+
+TopicLog::TopicLog(MessageLog &owner, std::filesystem::path directory)
+    : owner_(owner), directory_(std::move(directory)) {
+    recover();
+}
+
+TopicLog::~TopicLog() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void TopicLog::recover() {
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(directory_, ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.size() <= kSegmentSuffix.size() || name.compare(name.size() - kSegmentSuffix.size(),
+                                                                 kSegmentSuffix.size(), kSegmentSuffix) != 0) {
+            continue;
+        }
+        std::uint64_t base_offset{0};
+        const auto result = std::from_chars(name.data(), name.data() + name.size() - kSegmentSuffix.size(), base_offset);
+        if (result.ec == std::errc() && result.ptr == name.data() + name.size() - kSegmentSuffix.size()) {
+            segments_.push_back(Segment{base_offset, entry.path()});
+        }
+    }
+    if (segments_.empty()) {
+        return;
+    }
+
+    std::sort(segments_.begin(), segments_.end(),
+              [](const Segment &a, const Segment &b) { return a.base_offset < b.base_offset; });
+
+    // Only the last segment can end in a record torn by a crash
+    const auto &last = segments_.back();
+    next_offset_ = last.base_offset;
+    std::size_t valid{0};
+    {
+        MappedFile file(last.path);
+        valid = scan_records(file.bytes(), [this](std::uint64_t offset, std::string_view) {
+            next_offset_ = offset + 1;
+            return true;
+        });
+        if (valid != file.bytes().size()) {
+            BOOST_LOG_TRIVIAL(warning) << "[message_log] Dropping torn record at the end of " << last.path;
+        }
+    }
+    std::filesystem::resize_file(last.path, valid, ec);
+    written_offset_ = next_offset_;
+
+    fd_ = ::open(last.path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd_ < 0) {
+        BOOST_LOG_TRIVIAL(error) << "[message_log] Can not open " << last.path << ": " << std::strerror(errno);
+    }
+    segment_size_ = valid;
+}
+
+std::uint64_t TopicLog::append(std::string_view data) {
+    std::uint64_t offset;
+    {
+        std::lock_guard lock(owner_.queue_mutex_);
+        offset = next_offset_++;
+        owner_.queue_.push_back(MessageLog::Record{this, offset, std::string(data)});
+    }
+    owner_.queue_ready_.notify_one();
+    return offset;
+}
+
+std::uint64_t TopicLog::next_offset() const {
+    std::lock_guard lock(owner_.queue_mutex_);
+    return next_offset_;
+}
+
+void TopicLog::when_written(std::uint64_t offset, WrittenCallback callback) {
+    {
+        std::lock_guard lock(written_mutex_);
+        if (written_offset_ < offset) {
+            waiters_.emplace_back(offset, std::move(callback));
+            return;
+        }
+    }
+    callback();
+}
+
+void TopicLog::read(std::uint64_t from, std::uint64_t to, const ReadCallback &callback) const {
+    LogCursor cursor(*this, from);
+    cursor.read(to, [&callback](std::uint64_t offset, std::string_view data) {
+        callback(offset, data);
+        return true;
+    });
+}
+
+LogCursor::LogCursor(const TopicLog &log, std::uint64_t from) : log_(log), position_(from) {
+    std::lock_guard lock(log_.written_mutex_);
+    // Last segment starting at or before `from`, earlier ones only hold older records
+    const auto &segments = log_.segments_;
+    const auto it = std::upper_bound(segments.begin(), segments.end(), from,
+                                     [](std::uint64_t offset, const TopicLog::Segment &segment) {
+                                         return offset < segment.base_offset;
+                                     });
+    segment_ = it == segments.begin() ? 0 : static_cast<std::size_t>(it - segments.begin()) - 1;
+}
+
+LogCursor::~LogCursor() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+std::uint64_t LogCursor::position() const {
+    return position_;
+}
+
+void LogCursor::read(std::uint64_t to, const Callback &callback) {
+    // Taken before reading the files: every record before `to` is in them,
+    // and a segment followed by another one is complete
+    std::size_t segments;
+    {
+        std::lock_guard lock(log_.written_mutex_);
+        to = std::min(to, log_.written_offset_);
+        segments = log_.segments_.size();
+    }
+    if (segments <= segment_) {
+        position_ = std::max(position_, to);
+        return;
+    }
+    if (fd_ < 0 && buffer_.empty()) {
+        open_segment(segment_);
+    }
+
+    while (position_ < to) {
+        const std::string_view pending = std::string_view(buffer_).substr(parse_pos_);
+        std::size_t needed{kRecordHeaderSize};
+        if (pending.size() >= kRecordHeaderSize) {
+            const std::uint64_t offset = get_be(pending, 0, 8);
+            const std::size_t size = get_be(pending, 8, 4);
+            needed += size;
+            if (pending.size() >= needed) {
+                if (offset >= to) {
+                    return;
+                }
+                if (offset >= position_) {
+                    if (!callback(offset, pending.substr(kRecordHeaderSize, size))) {
+                        return;
+                    }
+                    position_ = offset + 1;
+                }
+                parse_pos_ += needed;
+                continue;
+            }
+        }
+
+        if (fill(needed)) {
+            continue;
+        }
+        if (segment_ + 1 < segments) {
+            open_segment(segment_ + 1);
+            continue;
+        }
+        // End of the written records, the rest before `to` never made it to disk
+        position_ = to;
+    }
+}
+
+void LogCursor::open_segment(std::size_t segment) {
+    std::filesystem::path path;
+    {
+        std::lock_guard lock(log_.written_mutex_);
+        path = log_.segments_[segment].path;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    segment_ = segment;
+    buffer_.clear();
+    buffer_file_pos_ = 0;
+    parse_pos_ = 0;
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        BOOST_LOG_TRIVIAL(error) << "[message_log] Can not open " << path << ": " << std::strerror(errno);
+    }
+}
+
+bool LogCursor::fill(std::size_t bytes) {
+    constexpr std::size_t kReadBytes{64 * 1024};
+    if (fd_ < 0) {
+        return false;
+    }
+    // Parsed bytes are not needed anymore
+    buffer_.erase(0, parse_pos_);
+    buffer_file_pos_ += parse_pos_;
+    parse_pos_ = 0;
+
+    const std::size_t held = buffer_.size();
+    buffer_.resize(held + std::max(kReadBytes, bytes - std::min(bytes, held)));
+    ssize_t got;
+    do {
+        got = ::pread(fd_, buffer_.data() + held, buffer_.size() - held,
+                      static_cast<off_t>(buffer_file_pos_ + held));
+    } while (got < 0 && errno == EINTR);
+    buffer_.resize(held + static_cast<std::size_t>(std::max<ssize_t>(got, 0)));
+    if (got < 0) {
+        BOOST_LOG_TRIVIAL(error) << "[message_log] Can not read segment: " << std::strerror(errno);
+    }
+    return got > 0;
+}
+
+void TopicLog::open_segment(std::uint64_t base_offset) {
+    if (fd_ >= 0) {
+        if (owner_.options_.fsync != FsyncPolicy::NEVER) {
+            sync();
+        }
+        ::close(fd_);
+    }
+
+    Segment segment{base_offset, segment_path(directory_, base_offset)};
+    fd_ = ::open(segment.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        BOOST_LOG_TRIVIAL(error) << "[message_log] Can not create " << segment.path << ": " << std::strerror(errno);
+    }
+    segment_size_ = 0;
+    dirty_ = false;
+
+    std::lock_guard lock(written_mutex_);
+    segments_.push_back(std::move(segment));
+}
+
+void TopicLog::write_records(const std::string &records, std::uint64_t first_offset, std::uint64_t end_offset) {
+    if (fd_ < 0 || segment_size_ >= owner_.options_.segment_bytes) {
+        open_segment(first_offset);
+    }
+
+    if (fd_ < 0 || !write_all(fd_, records)) {
+        BOOST_LOG_TRIVIAL(error) << "[message_log] Lost records " << first_offset << " to " << end_offset - 1
+                                 << " of " << directory_ << ": " << std::strerror(errno);
+    } else {
+        segment_size_ += records.size();
+        dirty_ = true;
+    }
+}
+
+void TopicLog::mark_written(std::uint64_t end_offset) {
+    std::vector<WrittenCallback> due;
+    {
+        std::lock_guard lock(written_mutex_);
+        written_offset_ = end_offset;
+        const auto waiting = std::partition(waiters_.begin(), waiters_.end(),
+                                            [end_offset](const auto &waiter) { return waiter.first > end_offset; });
+        for (auto it = waiting; it != waiters_.end(); ++it) {
+            due.push_back(std::move(it->second));
+        }
+        waiters_.erase(waiting, waiters_.end());
+    }
+    // Outside the lock, a callback may wait for the next records
+    for (auto &callback : due) {
+        callback();
+    }
+}
+
+void TopicLog::sync() {
+    if (dirty_ && fd_ >= 0) {
+        ::fdatasync(fd_);
+        dirty_ = false;
+    }
+}
+
+MessageLog::MessageLog(Options options)
+    : options_(std::move(options)), last_sync_(std::chrono::steady_clock::now()), writer_([this]() { run_writer(); }) {}
+
+MessageLog::~MessageLog() {
+    {
+        std::lock_guard lock(queue_mutex_);
+        stopping_ = true;
+    }
+    queue_ready_.notify_one();
+    writer_.join();
+
+    if (options_.fsync != FsyncPolicy::NEVER) {
+        for (auto &[name, log] : topics_) {
+            log->sync();
+        }
+    }
+}
+
+std::shared_ptr<TopicLog> MessageLog::open(std::string_view topic) {
+    std::lock_guard lock(topics_mutex_);
+    if (auto it = topics_.find(topic); it != topics_.end()) {
+        return it->second;
+    }
+
+    const auto directory = options_.directory / directory_name(topic);
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec) {
+        BOOST_LOG_TRIVIAL(error) << "[message_log] Can not create " << directory << ": " << ec.message();
+        return nullptr;
+    }
+
+    auto log = std::make_shared<TopicLog>(*this, directory);
+    topics_.emplace(topic, log);
+    return log;
+}
+
+const MessageLog::Options &MessageLog::options() const {
+    return options_;
+}
+
+void MessageLog::run_writer() {
+    std::vector<Record> batch;
+    for (;;) {
+        {
+            std::unique_lock lock(queue_mutex_);
+            // Wakes up once per fsync interval, so the interval policy also
+            // syncs when nothing is published
+            queue_ready_.wait_for(lock, options_.fsync_interval, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty() && stopping_) {
+                return;
+            }
+            // Everything queued so far becomes one batch
+            batch.swap(queue_);
+        }
+
+        write_batch(batch);
+        batch.clear();
+    }
+}
+
+// Also called with an empty batch when the writer wakes up idle
+void MessageLog::write_batch(std::vector<Record> &batch) {
+    // Encode each topic's records back to back so every topic gets one write
+    struct Pending {
+        std::string records;
+        std::uint64_t first_offset;
+        std::uint64_t end_offset;
+    };
+    std::map<TopicLog *, Pending> pending;
+    for (auto &record : batch) {
+        auto [it, inserted] = pending.try_emplace(record.log, Pending{{}, record.offset, record.offset});
+        auto &topic = it->second;
+        put_u64(topic.records, record.offset);
+        put_u32(topic.records, static_cast<std::uint32_t>(record.data.size()));
+        topic.records.append(record.data);
+        topic.end_offset = record.offset + 1;
+    }
+
+    for (auto &[log, topic] : pending) {
+        log->write_records(topic.records, topic.first_offset, topic.end_offset);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (options_.fsync == FsyncPolicy::BATCH) {
+        for (auto &[log, topic] : pending) {
+            log->sync();
+        }
+    } else if (options_.fsync == FsyncPolicy::INTERVAL && now - last_sync_ >= options_.fsync_interval) {
+        std::lock_guard lock(topics_mutex_);
+        for (auto &[name, log] : topics_) {
+            log->sync();
+        }
+        last_sync_ = now;
+    }
+
+    // Readers only see records once they are in the segment files
+    for (auto &[log, topic] : pending) {
+        log->mark_written(topic.end_offset);
+    }
+}
+
+}  // namespace pubsub
@@ -0,0 +1,294 @@
+#include "metrics_server.h"
+#include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace pubsub::server {
+
+namespace {
+
+constexpr std::size_t kMaxRequestSize{8 * 1024};
+
+void add_metric(std::string &out, const char *name, const char *type, const char *help, std::uint64_t value) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    out.append(name).append(" ").append(std::to_string(value)).append("\n");
+}
+
+std::string seconds(std::uint64_t nanoseconds) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.9g", static_cast<double>(nanoseconds) / 1e9);
+    return buffer;
+}
+
+void add_stage(std::string &out, const char *stage, const StatsSnapshot::Histogram &histogram) {
+    const std::string labels = std::string("stage=\"") + stage + "\"";
+    std::uint64_t count{0};
+    for (std::size_t i = 0; i < kStageBucketBounds.size(); ++i) {
+        count += histogram.buckets[i];
+        out.append("pubsub_stage_duration_seconds_bucket{")
+            .append(labels)
+            .append(",le=\"")
+            .append(seconds(kStageBucketBounds[i]))
+            .append("\"} ")
+            .append(std::to_string(count))
+            .append("\n");
+    }
+    count += histogram.buckets.back();
+    out.append("pubsub_stage_duration_seconds_bucket{").append(labels).append(",le=\"+Inf\"} ");
+    out.append(std::to_string(count)).append("\n");
+    out.append("pubsub_stage_duration_seconds_sum{").append(labels).append("} ");
+    out.append(seconds(histogram.sum_ns)).append("\n");
+    out.append("pubsub_stage_duration_seconds_count{").append(labels).append("} ");
+    out.append(std::to_string(count)).append("\n");
+}
+
+// Label values escape backslash, double quote and newline
+std::string label_value(std::string_view value) {
+    std::string out;
+    out.reserve(value.size());
+    for (const char c : value) {
+        if (c == '\\' || c == '"') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c == '\n') {
+            out.append("\\n");
+        } else {
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+std::string http_response(const char *status, const std::string &content_type, const std::string &body) {
+    std::string response;
+    response.append("HTTP/1.1 ").append(status).append("\r\n");
+    response.append("Content-Type: ").append(content_type).append("\r\n");
+    response.append("Content-Length: ").append(std::to_string(body.size())).append("\r\n");
+    response.append("Connection: close\r\n\r\n");
+    response.append(body);
+    return response;
+}
+
+}  // namespace
+
+MetricsServer::MetricsServer(boost::asio::io_context &io_context, unsigned short port, ServerStats &stats,
+                             TopicManager &topic_manager, std::size_t top_topics,
+                             std::chrono::milliseconds refresh_interval)
+    : acceptor_(io_context),
+      stats_(stats),
+      topic_manager_(topic_manager),
+      top_topics_(top_topics),
+      refresh_interval_(refresh_interval),
+      previous_refresh_(std::chrono::steady_clock::now()) {
+    stats_.set_timing(true);
+    refresher_ = std::thread([this]() { refresh_loop(); });
+
+    const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
+    boost::system::error_code ec;
+    acceptor_.open(endpoint.protocol(), ec);
+    if (!ec) {
+        acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true), ec);
+    }
+    if (!ec) {
+        acceptor_.bind(endpoint, ec);
+    }
+    if (!ec) {
+        acceptor_.listen(boost::asio::socket_base::max_listen_connections, ec);
+    }
+    if (ec) {
+        BOOST_LOG_TRIVIAL(error) << "[metrics] Can not listen on port " << port << ": " << ec.message();
+        return;
+    }
+
+    BOOST_LOG_TRIVIAL(info) << "[metrics] Serving metrics on port " << port;
+    start_accept();
+}
+
+MetricsServer::~MetricsServer() {
+    {
+        std::lock_guard lock(top_mutex_);
+        stopping_ = true;
+    }
+    refresh_.notify_one();
+    refresher_.join();
+}
+
+void MetricsServer::refresh_loop() {
+    std::unique_lock lock(top_mutex_);
+    while (!stopping_) {
+        if (refresh_.wait_for(lock, refresh_interval_, [this]() { return stopping_; })) {
+            break;
+        }
+        lock.unlock();
+        refresh_top_topics();
+        lock.lock();
+    }
+}
+
+// Runs on the refresh thread, walking the topics takes their shard locks shared.
+// Only the names of the busiest topics are copied.
+void MetricsServer::refresh_top_topics() {
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::max(std::chrono::duration<double>(now - previous_refresh_).count(), 1e-3);
+
+    struct Candidate {
+        TopicManager::TopicId topic;
+        std::uint64_t messages;
+        double rate;
+    };
+    // Heap of the busiest topics seen so far, the least busy of them in front
+    const auto busier = [](const Candidate &a, const Candidate &b) { return a.rate > b.rate; };
+    std::vector<Candidate> top;
+    top.reserve(top_topics_);
+    std::vector<std::uint64_t> counts(previous_counts_.size());
+    topic_manager_.visit_message_counts([&](TopicManager::TopicId topic, std::uint64_t messages) {
+        const std::uint64_t previous = topic < previous_counts_.size() ? previous_counts_[topic] : 0;
+        // A reused id counts from zero again
+        const std::uint64_t delta = messages >= previous ? messages - previous : messages;
+        if (topic >= counts.size()) {
+            counts.resize(topic + 1);
+        }
+        counts[topic] = messages;
+
+        const Candidate candidate{topic, messages, static_cast<double>(delta) / elapsed};
+        if (top.size() < top_topics_) {
+            top.push_back(candidate);
+            std::push_heap(top.begin(), top.end(), busier);
+        } else if (!top.empty() && busier(candidate, top.front())) {
+            std::pop_heap(top.begin(), top.end(), busier);
+            top.back() = candidate;
+            std::push_heap(top.begin(), top.end(), busier);
+        }
+    });
+    previous_counts_ = std::move(counts);
+    previous_refresh_ = now;
+
+    // Busiest first
+    std::sort_heap(top.begin(), top.end(), busier);
+    std::vector<TopicRate> rates;
+    rates.reserve(top.size());
+    for (const auto &candidate : top) {
+        if (auto name = topic_manager_.topic_name(candidate.topic); !name.empty()) {
+            rates.push_back({std::move(name), candidate.messages, candidate.rate});
+        }
+    }
+
+    std::lock_guard lock(top_mutex_);
+    top_ = std::move(rates);
+}
+
+std::string MetricsServer::render() {
+    const StatsSnapshot snapshot = stats_.totals(topic_manager_);
+
+    std::string out;
+    add_metric(out, "pubsub_frames_received_total", "counter", "Frames read from clients.", snapshot.frames_in);
+    add_metric(out, "pubsub_bytes_received_total", "counter", "Bytes read from clients.", snapshot.bytes_in);
+    add_metric(out, "pubsub_frames_sent_total", "counter", "Frames written to clients.", snapshot.frames_out);
+    add_metric(out, "pubsub_bytes_sent_total", "counter", "Bytes written to clients.", snapshot.bytes_out);
+    add_metric(out, "pubsub_write_errors_total", "counter", "Failed writes to clients.", snapshot.write_errors);
+    add_metric(out, "pubsub_connections_accepted_total", "counter", "Accepted client connections.",
+               snapshot.connections_accepted);
+    add_metric(out, "pubsub_connections", "gauge", "Open client connections.", snapshot.connections);
+    add_metric(out, "pubsub_topics", "gauge", "Topics with at least one subscriber.", snapshot.topics);
+    add_metric(out, "pubsub_subscriptions", "gauge", "Subscriptions, including wildcard filters.",
+               snapshot.subscriptions);
+    add_metric(out, "pubsub_unrouted_publishes_total", "counter", "Publishes that reached no subscriber.",
+               snapshot.unrouted_publishes);
+
+    out.append("# HELP pubsub_slow_consumer_events_total Slow consumer policy actions.\n");
+    out.append("# TYPE pubsub_slow_consumer_events_total counter\n");
+    out.append("pubsub_slow_consumer_events_total{policy=\"drop-newest\"} ");
+    out.append(std::to_string(snapshot.dropped_newest)).append("\n");
+    out.append("pubsub_slow_consumer_events_total{policy=\"drop-oldest\"} ");
+    out.append(std::to_string(snapshot.dropped_oldest)).append("\n");
+    out.append("pubsub_slow_consumer_events_total{policy=\"disconnect\"} ");
+    out.append(std::to_string(snapshot.slow_consumer_disconnects)).append("\n");
+
+    add_metric(out, "pubsub_outbound_queued_frames", "gauge", "Frames queued for clients.", snapshot.queued_frames);
+    add_metric(out, "pubsub_outbound_queued_bytes", "gauge", "Bytes queued for clients.", snapshot.queued_bytes);
+
+    out.append("# HELP pubsub_stage_duration_seconds Time spent parsing frames, routing publishes and writing.\n");
+    out.append("# TYPE pubsub_stage_duration_seconds histogram\n");
+    add_stage(out, "parse", snapshot.parse);
+    add_stage(out, "route", snapshot.route);
+    add_stage(out, "write", snapshot.write);
+
+    // Busiest topics at the last refresh
+    std::vector<TopicRate> rates;
+    {
+        std::lock_guard lock(top_mutex_);
+        rates = top_;
+    }
+
+    out.append("# HELP pubsub_topic_messages_total Messages published to the busiest topics.\n");
+    out.append("# TYPE pubsub_topic_messages_total counter\n");
+    for (const auto &rate : rates) {
+        out.append("pubsub_topic_messages_total{topic=\"").append(label_value(rate.topic)).append("\"} ");
+        out.append(std::to_string(rate.messages)).append("\n");
+    }
+    out.append("# HELP pubsub_topic_messages_per_second Publish rate of the busiest topics over the last refresh.\n");
+    out.append("# TYPE pubsub_topic_messages_per_second gauge\n");
+    for (const auto &rate : rates) {
+        out.append("pubsub_topic_messages_per_second{topic=\"").append(label_value(rate.topic)).append("\"} ");
+        out.append(std::to_string(rate.rate)).append("\n");
+    }
+    return out;
+}
+
+void MetricsServer::start_accept() {
+    acceptor_.async_accept([this](const boost::system::error_code &error, boost::asio::ip::tcp::socket socket) {
+        if (error) {
+            if (error != boost::asio::error::operation_aborted) {
+                BOOST_LOG_TRIVIAL(error) << "[metrics] Error accepting connection: " << error.message();
+            }
+            return;
+        }
+        handle_request(std::make_shared<boost::asio::ip::tcp::socket>(std::move(socket)));
+        start_accept();
+    });
+}
+
+void MetricsServer::handle_request(std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
+    auto request = std::make_shared<boost::asio::streambuf>(kMaxRequestSize);
+    // Closing the socket fails the read, a client trickling bytes can not hold it open
+    auto deadline = std::make_shared<boost::asio::steady_timer>(socket->get_executor(), kRequestTimeout);
+    deadline->async_wait([socket](const boost::system::error_code &error) {
+        if (!error) {
+            BOOST_LOG_TRIVIAL(debug) << "[metrics] Request timed out";
+            boost::system::error_code ec;
+            socket->close(ec);
+        }
+    });
+    boost::asio::async_read_until(
+        *socket, *request, "\r\n\r\n",
+        [this, socket, request, deadline](const boost::system::error_code &error, std::size_t) {
+            deadline->cancel();
+            if (error) {
+                BOOST_LOG_TRIVIAL(debug) << "[metrics] Error reading request: " << error.message();
+                return;
+            }
+
+            std::istream is(request.get());
+            std::string method;
+            std::string target;
+            is >> method >> target;
+
+            auto response = std::make_shared<std::string>();
+            if (method == "GET" && (target == "/metrics" || target.rfind("/metrics?", 0) == 0)) {
+                *response = http_response("200 OK", "text/plain; version=0.0.4; charset=utf-8", render());
+            } else {
+                *response = http_response("404 Not Found", "text/plain; charset=utf-8", "Not found\n");
+            }
+
+            boost::asio::async_write(*socket, boost::asio::buffer(*response),
+                                     [socket, response](const boost::system::error_code &, std::size_t) {
+                                         boost::system::error_code ec;
+                                         socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+                                         socket->close(ec);
+                                     });
+        });
+}
+
+}  // namespace pubsub::server
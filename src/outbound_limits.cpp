@@ -0,0 +1,16 @@
+#include "outbound_limits.h"
+
+namespace pubsub {
+
+std::optional<SlowConsumerPolicy> parse_slow_consumer_policy(std::string_view name) {
+    if (name == "drop-newest") {
+        return SlowConsumerPolicy::DROP_NEWEST;
+    } else if (name == "drop-oldest") {
+        return SlowConsumerPolicy::DROP_OLDEST;
+    } else if (name == "disconnect") {
+        return SlowConsumerPolicy::DISCONNECT;
+    }
+    return std::nullopt;
+}
+
+}  // namespace pubsub
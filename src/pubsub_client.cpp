@@ -2,63 +2,125 @@
 #include <boost/log/trivial.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/utility/setup/console.hpp>
+#include <array>
+#include "logging.h"
+#include "spawn.h"
 
 namespace pubsub::client {
 
-PubSubClient::PubSubClient(boost::asio::io_context &io_context)
+namespace {
+
+// Ring reads per turn, so a busy ring does not starve the rest of the io_context
+constexpr int kRingReadsPerTurn{16};
+
+}  // namespace
+
+PubSubClient::PubSubClient(boost::asio::io_context &io_context, ProtocolVersion protocol)
     : Client(),
       exec_{io_context.get_executor()},
-      socket_{std::make_shared<boost::asio::ip::tcp::socket>(io_context)} {}
+      socket_{std::make_shared<boost::asio::generic::stream_protocol::socket>(io_context)},
+      requested_protocol_{protocol},
+      linger_timer_{io_context} {}
+
+void PubSubClient::set_write_batching(std::chrono::microseconds linger, std::size_t max_batch_bytes) {
+    linger_ = linger;
+    max_batch_bytes_ = max_batch_bytes;
+}
+
+void PubSubClient::enable_compression(std::size_t threshold) {
+    compression_threshold_ = threshold;
+}
 
 void PubSubClient::connect(const std::string &client_name) {
     client_name_ = client_name;
-    boost::asio::post(exec_, [this, client_name]() {
-        BOOST_LOG_TRIVIAL(debug) << "[" << client_name << "] Connect as : " << client_name;
-        Message msg;
-        msg.type = MessageType::CONNECT;
-        msg.data = client_name;
-        write(msg);
-    });
+    BOOST_LOG_TRIVIAL(debug) << "[" << client_name << "] Connect as : " << client_name;
+    Message msg;
+    msg.type = MessageType::CONNECT;
+    msg.data = client_name;
+    msg.version = requested_protocol_;
+    if (compression_threshold_ != 0 && requested_protocol_ == ProtocolVersion::BINARY) {
+        msg.capabilities = Message::kCapabilityCompression;
+    }
+
+    std::lock_guard lock(outbound_mutex_);
+    write(msg.view());
+    // Only a server that accepted another version switches its reader right after the CONNECT
+    awaiting_connack_ = requested_protocol_ != ProtocolVersion::TEXT;
 }
 
 void PubSubClient::disconnect() {
-    boost::asio::post(exec_, [this]() {
-        BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Disconnect";
-        Message msg;
-        msg.type = MessageType::DISCONNECT;
-        write(msg);
-    });
+    BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Disconnect";
+    Message msg;
+    msg.type = MessageType::DISCONNECT;
+
+    std::lock_guard lock(outbound_mutex_);
+    send(msg.view());
 }
 
 void PubSubClient::publish(const std::string &topic, const std::string &data) {
-    boost::asio::post(exec_, [this, topic, data]() {
-        BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Publishing to topic: " << topic;
-        Message msg;
-        msg.type = MessageType::PUBLISH;
-        msg.topic = topic;
-        msg.data = data;
-        write(msg);
-    });
+    PUBSUB_LOG(trace) << "[" << client_name_ << "] Publishing to topic: " << topic;
+    // Encoded straight from the caller's strings into the outbound batch
+    MessageView msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = topic;
+    msg.data = data;
+
+    std::lock_guard lock(outbound_mutex_);
+    if (write_compression_ && data.size() >= compression_threshold_ && compression::compress(data, compressed_)) {
+        msg.data = compressed_;
+        msg.compressed = true;
+    }
+    if (write_protocol_ == ProtocolVersion::BINARY) {
+        assign_topic_alias(topic, msg);
+    }
+    send(msg);
 }
 
-void PubSubClient::subscribe(const std::string &topic) {
-    boost::asio::post(exec_, [this, topic]() {
-        BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Subscribing to topic: " << topic;
-        Message msg;
-        msg.type = MessageType::SUBSCRIBE;
-        msg.topic = topic;
-        write(msg);
-    });
+void PubSubClient::assign_topic_alias(const std::string &topic, MessageView &msg) {
+    auto it = topic_aliases_.find(topic);
+    if (it != topic_aliases_.end()) {
+        // Alias already known to the server, the name is not sent again
+        msg.alias = it->second;
+        msg.topic = {};
+        return;
+    }
+
+    const auto alias = static_cast<std::uint32_t>(topic_aliases_.size());
+    if (alias <= Message::kMaxTopicAlias) {
+        // Defined by sending it along with the name on first use
+        msg.alias = alias;
+        topic_aliases_.emplace(topic, alias);
+    }
+}
+
+void PubSubClient::subscribe(const std::string &topic, std::uint64_t offset) {
+    BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Subscribing to topic: " << topic;
+    Message msg;
+    msg.type = MessageType::SUBSCRIBE;
+    msg.topic = topic;
+    msg.offset = offset;
+
+    std::lock_guard lock(outbound_mutex_);
+    send(msg.view());
 }
 
 void PubSubClient::unsubscribe(const std::string &topic) {
-    boost::asio::post(exec_, [this, topic]() {
-        BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Unsubscribing from topic: " << topic;
-        Message msg;
-        msg.type = MessageType::UNSUBSCRIBE;
-        msg.topic = topic;
-        write(msg);
-    });
+    BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Unsubscribing from topic: " << topic;
+    Message msg;
+    msg.type = MessageType::UNSUBSCRIBE;
+    msg.topic = topic;
+
+    std::lock_guard lock(outbound_mutex_);
+    send(msg.view());
+}
+
+void PubSubClient::stats() {
+    BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Requesting stats";
+    Message msg;
+    msg.type = MessageType::STATS;
+
+    std::lock_guard lock(outbound_mutex_);
+    send(msg.view());
 }
 
 void PubSubClient::on_message_received(const std::string &topic, const std::string &message) {
@@ -68,17 +130,92 @@ void PubSubClient::on_message_received(const std::string &topic, const std::stri
                             << "\"";
 }
 
-void PubSubClient::write(const Message &message) {
-    boost::system::error_code error;
-    boost::asio::write(*socket_, boost::asio::buffer(message.serialize()), error);
+void PubSubClient::on_stats_received(const std::string &stats) {
+    BOOST_LOG_TRIVIAL(info) << "[" << client_name_ << "] [Stats] " << stats;
+}
+
+void PubSubClient::send(const MessageView &message) {
+    if (!awaiting_connack_) {
+        write(message);
+        return;
+    }
+    auto &held = held_.emplace_back();
+    held.type = message.type;
+    held.topic = message.topic;
+    held.data = message.data;
+    held.offset = message.offset;
+}
+
+void PubSubClient::write(const MessageView &message) {
+    const std::size_t buffered = outbound_.size();
+    message.serialize_to(outbound_, write_protocol_);
+
+    if (!flush_scheduled_) {
+        // One post per batch, frames written until the flush runs join it
+        flush_scheduled_ = true;
+        boost::asio::post(exec_, bind_memory(*flush_memory_, [this, memory = flush_memory_]() { schedule_flush(); }));
+    } else if (buffered < max_batch_bytes_ && outbound_.size() >= max_batch_bytes_) {
+        // Batch is full, do not wait out the linger
+        boost::asio::post(exec_, bind_memory(*flush_memory_, [this, memory = flush_memory_]() { flush(); }));
+    }
+}
+
+void PubSubClient::schedule_flush() {
+    if (linger_.count() == 0) {
+        flush();
+        return;
+    }
+
+    linger_timer_.expires_after(linger_);
+    linger_timer_.async_wait([this](const boost::system::error_code &error) {
+        if (!error) {
+            flush();
+        }
+    });
+}
+
+void PubSubClient::flush() {
+    if (channel_) {
+        flush_ring();
+        return;
+    }
+
+    // A write in progress picks up the buffered frames on completion
+    if (write_in_progress_) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(outbound_mutex_);
+        flush_scheduled_ = false;
+        if (outbound_.empty()) {
+            return;
+        }
+        writing_.swap(outbound_);
+    }
+
+    linger_timer_.cancel();
+    write_in_progress_ = true;
+    boost::asio::async_write(*socket_, boost::asio::buffer(writing_),
+                             [this](const boost::system::error_code &error, std::size_t bytes_transferred) {
+                                 handle_write(error, bytes_transferred);
+                             });
+}
+
+void PubSubClient::handle_write(const boost::system::error_code &error, std::size_t bytes_transferred) {
+    write_in_progress_ = false;
+    writing_.clear();
 
     if (!error) {
-        BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Message written successfully";
+        PUBSUB_LOG(trace) << "[" << client_name_ << "] Wrote " << bytes_transferred << " bytes";
     } else if (error == boost::asio::error::eof) {
         BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Write failed: disconnected";
-    } else {
+    } else if (error != boost::asio::error::operation_aborted) {
         BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Error writing to server: " << error.message();
     }
+
+    // Frames buffered meanwhile go out right away, they already waited for this write
+    flush();
 }
 
 void PubSubClient::connect_socket(const std::string &host, const std::string &port) {
@@ -88,82 +225,290 @@ void PubSubClient::connect_socket(const std::string &host, const std::string &po
         BOOST_LOG_TRIVIAL(debug) << "[client] Attempting to connect " << host << ":" << port;
         boost::asio::ip::tcp::resolver resolver(socket_->get_executor());
         auto endpoints = resolver.resolve(host, port);
+        boost::asio::ip::tcp::socket socket(socket_->get_executor());
         boost::system::error_code error;
-        boost::asio::connect(*socket_, endpoints, error);
+        boost::asio::connect(socket, endpoints, error);
 
         if (!error) {
             BOOST_LOG_TRIVIAL(info) << "[client] Connected to server " << host << ":" << port;
+            *socket_ = std::move(socket);
             // Start reading messages asynchronously
-            start_reading();
+            boost::asio::co_spawn(exec_, read_loop(socket_), rethrow_on_error);
         } else {
             BOOST_LOG_TRIVIAL(error) << "[client] Connection failed " << host << ":" << port << " " << error.message();
         }
     });
 }
 
+void PubSubClient::connect_local(const std::string &path) {
+    BOOST_LOG_TRIVIAL(debug) << "[client] Posting Connect socket : " << path;
+
+    boost::asio::post(exec_, [this, path]() {
+        boost::asio::local::stream_protocol::socket socket(socket_->get_executor());
+        boost::system::error_code error;
+        socket.connect(boost::asio::local::stream_protocol::endpoint(path), error);
+
+        if (!error) {
+            BOOST_LOG_TRIVIAL(info) << "[client] Connected to server " << path;
+            *socket_ = std::move(socket);
+            boost::asio::co_spawn(exec_, read_loop(socket_), rethrow_on_error);
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "[client] Connection failed " << path << " " << error.message();
+        }
+    });
+}
+
+void PubSubClient::connect_shared_memory(const std::string &path, std::chrono::microseconds spin,
+                                         std::size_t ring_bytes) {
+    BOOST_LOG_TRIVIAL(debug) << "[client] Posting Connect shared memory : " << path;
+
+    boost::asio::post(exec_, [this, path, spin, ring_bytes]() {
+        boost::asio::local::stream_protocol::socket socket(socket_->get_executor());
+        boost::system::error_code error;
+        socket.connect(boost::asio::local::stream_protocol::endpoint(path), error);
+        if (!error) {
+            // The only frame sent over the socket, the server answers with the segment
+            Message msg;
+            msg.type = MessageType::SHM;
+            msg.data = std::to_string(ring_bytes);
+            boost::asio::write(socket, boost::asio::buffer(msg.serialize()), error);
+        }
+        if (error) {
+            BOOST_LOG_TRIVIAL(error) << "[client] Connection failed " << path << " " << error.message();
+            return;
+        }
+        const int fd = receive_descriptor(socket.native_handle());
+        auto channel = fd >= 0 ? ShmChannel::open(fd) : nullptr;
+        if (!channel) {
+            BOOST_LOG_TRIVIAL(error) << "[client] Server did not set up shared memory " << path;
+            return;
+        }
+
+        BOOST_LOG_TRIVIAL(info) << "[client] Connected to server " << path << " through shared memory";
+        *socket_ = std::move(socket);
+        channel_ = std::move(channel);
+        ring_written_ = 0;
+        spin_ = spin;
+        // Parks until the server has something for us
+        boost::asio::co_spawn(exec_, ring_loop(socket_), rethrow_on_error);
+    });
+}
+
+void PubSubClient::flush_ring() {
+    {
+        std::lock_guard lock(outbound_mutex_);
+        flush_scheduled_ = false;
+        if (writing_.empty()) {
+            writing_.swap(outbound_);
+        } else {
+            writing_.append(outbound_);
+            outbound_.clear();
+        }
+    }
+    if (writing_.empty()) {
+        return;
+    }
+
+    linger_timer_.cancel();
+    const auto written =
+        channel_->outbound().write(writing_.data() + ring_written_, writing_.size() - ring_written_);
+    ring_written_ += written;
+    if (ring_written_ == writing_.size()) {
+        writing_.clear();
+        ring_written_ = 0;
+    }
+    // Whatever did not fit goes out once the server made room and rang the doorbell
+    if (written != 0) {
+        channel_->notify_peer(socket_->native_handle());
+    }
+}
+
+boost::asio::awaitable<void> PubSubClient::ring_loop(SocketSPtr socket) {
+    ReadBuffer buffer;
+    std::array<char, 64> doorbells;
+    boost::system::error_code error;
+    auto idle_since = std::chrono::steady_clock::now();
+    while (channel_) {
+        if (!service_ring(buffer, idle_since)) {
+            // Still busy or spinning, let the rest of the io_context run first
+            co_await boost::asio::post(exec_, boost::asio::use_awaitable);
+            continue;
+        }
+
+        // Parked, the next doorbell brings us back
+        co_await socket->async_read_some(boost::asio::buffer(doorbells),
+                                         boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if (!channel_) {
+            // Disconnected meanwhile
+            co_return;
+        }
+        idle_since = std::chrono::steady_clock::now();
+        if (!error) {
+            continue;
+        }
+        service_ring(buffer, idle_since);
+        if (error == boost::asio::error::eof) {
+            BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Server disconnected";
+        } else {
+            BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Error reading from server: " << error.message();
+        }
+        co_return;
+    }
+}
+
+bool PubSubClient::service_ring(ReadBuffer &buffer, std::chrono::steady_clock::time_point &idle_since) {
+    channel_->wake();
+
+    std::size_t bytes{0};
+    for (int i = 0; i < kRingReadsPerTurn; ++i) {
+        const auto space = buffer.prepare();
+        const auto read = channel_->inbound().read(static_cast<char *>(space.data()), space.size());
+        if (read == 0) {
+            break;
+        }
+        PUBSUB_LOG(trace) << "[" << client_name_ << "] Received data: " << read << " bytes";
+        bytes += read;
+        buffer.commit(read);
+        process_frames(buffer);
+    }
+    if (bytes != 0) {
+        // The server may be waiting for room
+        channel_->notify_peer(socket_->native_handle());
+    }
+    flush_ring();
+
+    const auto now = std::chrono::steady_clock::now();
+    if (bytes != 0) {
+        idle_since = now;
+    }
+    return bytes == 0 && now - idle_since >= spin_ && channel_->park(!writing_.empty());
+}
+
 void PubSubClient::disconnect_socket() {
-    client_name_.clear();
-    socket_->close();
-    BOOST_LOG_TRIVIAL(info) << "[" << client_name_ << "] Disconnected from server";
-}
-
-void PubSubClient::start_reading() {
-    // Create a buffer for the client
-    auto client_buffer = std::make_shared<std::string>();
-    auto read_buffer = std::make_shared<std::array<char, 1024>>();
-
-    socket_->async_read_some(
-        boost::asio::buffer(*read_buffer),
-        [this, client_buffer, read_buffer](const boost::system::error_code &error, std::size_t bytes_transferred) {
-            if (!error) {
-                BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Received data: " << bytes_transferred << " bytes";
-                std::string message(read_buffer->data(), bytes_transferred);
-                BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Received raw message: " << message;
-
-                handle_read(socket_, client_buffer, read_buffer, error, bytes_transferred);
-            } else if (error == boost::asio::error::eof) {
-                BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Server disconnected";
-            } else {
-                BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Error reading from server: " << error.message();
-            }
-        });
+    {
+        std::lock_guard lock(outbound_mutex_);
+        write_protocol_ = ProtocolVersion::TEXT;
+        write_compression_ = false;
+        awaiting_connack_ = false;
+        held_.clear();
+        topic_aliases_.clear();
+    }
+
+    // Runs after the flush of anything sent before, like the DISCONNECT
+    boost::asio::post(exec_, [this]() {
+        linger_timer_.cancel();
+        if (channel_) {
+            // Best effort, the ring may not have room for everything
+            flush_ring();
+        }
+        std::string rest;
+        {
+            std::lock_guard lock(outbound_mutex_);
+            rest.swap(outbound_);
+            flush_scheduled_ = false;
+        }
+        if (!channel_ && !write_in_progress_ && !rest.empty()) {
+            // Still lingering, write the rest before closing, without blocking the calling threads
+            boost::system::error_code error;
+            boost::asio::write(*socket_, boost::asio::buffer(rest), error);
+        }
+        read_protocol_ = ProtocolVersion::TEXT;
+        // Logged by the read loop until here
+        client_name_.clear();
+        socket_->close();
+        channel_.reset();
+        writing_.clear();
+        ring_written_ = 0;
+        BOOST_LOG_TRIVIAL(info) << "[client] Disconnected from server";
+    });
 }
 
-void PubSubClient::handle_read(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-                               std::shared_ptr<std::string> client_buffer,
-                               std::shared_ptr<std::array<char, 1024>> read_buffer,
-                               const boost::system::error_code &error, std::size_t bytes_transferred) {
-    if (!error) {
-        // Append the received data to the client buffer
-        client_buffer->append(read_buffer->data(), bytes_transferred);
-
-        // Check if the buffer contains a complete message (delimited by endl)
-        std::size_t delimiter_pos = client_buffer->find(Message::kDelim);
-        while (delimiter_pos != std::string::npos) {
-            // Extract the complete message
-            std::string message = client_buffer->substr(0, delimiter_pos);
-            client_buffer->erase(0, delimiter_pos + 1);  // Remove the processed message from the buffer
-
-            // Log and process the message
-            BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Received message: " << message;
-            Message msg = Message::deserialize(message);
-            if (msg.type == MessageType::PUBLISH) {
-                on_message_received(msg.topic, msg.data);
-            }
+boost::asio::awaitable<void> PubSubClient::read_loop(SocketSPtr socket) {
+    // Fresh buffer per connection, nothing from a previous one is left over
+    ReadBuffer buffer;
+    boost::system::error_code error;
+    for (;;) {
+        const std::size_t bytes_transferred = co_await socket->async_read_some(
+            buffer.prepare(), boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if (error == boost::asio::error::eof) {
+            BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Server disconnected";
+            co_return;
+        }
+        if (error) {
+            BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Error reading from server: " << error.message();
+            co_return;
+        }
 
-            // Look for the next message in the buffer
-            delimiter_pos = client_buffer->find(Message::kDelim);
+        PUBSUB_LOG(trace) << "[" << client_name_ << "] Received data: " << bytes_transferred << " bytes";
+        buffer.commit(bytes_transferred);
+        process_frames(buffer);
+    }
+}
+
+void PubSubClient::process_frames(ReadBuffer &buffer) {
+    // Process every complete frame in place, the protocol may change after CONNACK
+    std::string_view pending = buffer.data();
+    std::string_view frame;
+    std::size_t frame_size = Message::next_frame(pending, read_protocol_, frame);
+    while (frame_size != 0) {
+        if (frame_size == Message::kFrameTooLarge) {
+            BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Frame exceeds " << Message::kMaxFrameSize
+                                     << " bytes, closing the connection";
+            // Fails the pending read, which ends the read loop
+            boost::system::error_code ec;
+            socket_->close(ec);
+            pending = {};
+            break;
+        }
+
+        // Log and process the message
+        PUBSUB_LOG(trace) << "[" << client_name_ << "] Received message: " << frame;
+        const MessageView msg = MessageView::parse(frame, read_protocol_);
+        if (msg.type == MessageType::PUBLISH) {
+            // Copied into buffers kept between messages, the frame is gone after this batch
+            received_topic_.assign(msg.topic);
+            if (!msg.compressed) {
+                received_data_.assign(msg.data);
+                on_message_received(received_topic_, received_data_);
+            } else if (compression::decompress(msg.data, received_data_)) {
+                on_message_received(received_topic_, received_data_);
+            } else {
+                BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Dropping message with invalid compressed data on "
+                                         << received_topic_;
+            }
+        } else if (msg.type == MessageType::STATS) {
+            on_stats_received(std::string(msg.data));
+        } else if (msg.type == MessageType::CONNACK) {
+            BOOST_LOG_TRIVIAL(debug) << "[" << client_name_ << "] Server accepted protocol version "
+                                     << static_cast<int>(msg.version);
+            read_protocol_ = msg.version;
+            {
+                std::lock_guard lock(outbound_mutex_);
+                write_protocol_ = msg.version;
+                write_compression_ = (msg.capabilities & Message::kCapabilityCompression) != 0;
+                awaiting_connack_ = false;
+                // Held since the CONNECT, they go out uncompressed, which is always allowed
+                for (const auto &held : held_) {
+                    MessageView view = held.view();
+                    if (held.type == MessageType::PUBLISH && write_protocol_ == ProtocolVersion::BINARY) {
+                        assign_topic_alias(held.topic, view);
+                    }
+                    write(view);
+                }
+                held_.clear();
+            }
+            if (read_protocol_ != requested_protocol_) {
+                BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Server rejected protocol version "
+                                         << static_cast<int>(requested_protocol_);
+            }
         }
 
-        // Continue reading from the client
-        socket->async_read_some(boost::asio::buffer(*read_buffer),
-                                [this, socket, client_buffer, read_buffer](const boost::system::error_code &error,
-                                                                           std::size_t bytes_transferred) {
-                                    handle_read(socket, client_buffer, read_buffer, error, bytes_transferred);
-                                });
-    } else {
-        BOOST_LOG_TRIVIAL(error) << "[" << client_name_ << "] Error reading from server: " << error.message();
+        // Look for the next message in the buffer
+        pending.remove_prefix(frame_size);
+        frame_size = Message::next_frame(pending, read_protocol_, frame);
     }
+    // Drop the processed messages, an incomplete frame stays for the next read
+    buffer.consume(buffer.data().size() - pending.size());
 }
 
 }  // namespace pubsub::client
@@ -2,19 +2,45 @@
 #include <boost/log/trivial.hpp>
 #include <boost/log/utility/setup/common_attributes.hpp>
 #include <boost/log/utility/setup/file.hpp>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <array>
+#include <charconv>
 #include <iostream>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include "compression.h"
+#include "frame_pool.h"
+#include "io_backend.h"
+#include "logging.h"
 #include "message.h"
+#include "spawn.h"
 
 namespace pubsub::server {
 
+namespace {
+
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+// Ring reads per turn of a shared memory client, so it can not starve the rest of the worker
+constexpr int kShmReadsPerTurn{16};
+
+}  // namespace
+
 PubSubServer::PubSubServer(boost::asio::io_context &io_context, short port)
+    : PubSubServer(io_context, port, nullptr) {}
+
+PubSubServer::PubSubServer(boost::asio::io_context &io_context, short port,
+                           std::shared_ptr<TopicManager> topic_manager, std::shared_ptr<ServerStats> stats)
     : Server(),
       acceptor_(io_context),
+      local_acceptor_(io_context),
+      topic_manager_(topic_manager ? topic_manager : std::make_shared<TopicManager>()),
+      stats_(stats ? stats : std::make_shared<ServerStats>()),
+      worker_(stats_->add_worker()),
       endp_(boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)) {
-    BOOST_LOG_TRIVIAL(info) << "[server] Server started on port " << port;
+    BOOST_LOG_TRIVIAL(info) << "[server] Server started on port " << port << " (" << kIoBackend << ")";
 
     boost::system::error_code ec;
     acceptor_.open(endp_.protocol(), ec);
@@ -26,6 +52,15 @@ PubSubServer::PubSubServer(boost::asio::io_context &io_context, short port)
     acceptor_.set_option(
         boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol>::reuse_address(true));
 
+    // Workers sharing a topic manager listen on the same port
+    if (topic_manager) {
+        acceptor_.set_option(reuse_port(true), ec);
+        if (ec) {
+            BOOST_LOG_TRIVIAL(error) << "[server] socket reuse port error " << ec.message();
+            return;
+        }
+    }
+
     acceptor_.bind(endp_, ec);
     if (ec) {
         BOOST_LOG_TRIVIAL(error) << "[server] socket bind error " << ec.message();
@@ -38,121 +73,316 @@ PubSubServer::PubSubServer(boost::asio::io_context &io_context, short port)
         return;
     }
 
-    start_accept();
+    boost::asio::co_spawn(io_context, accept_loop(acceptor_), rethrow_on_error);
 }
 
-void PubSubServer::start_accept() {
-    BOOST_LOG_TRIVIAL(debug) << "[server] Waiting for new connection...";
-    auto socket = std::make_shared<boost::asio::ip::tcp::socket>(acceptor_.get_executor());
-    acceptor_.async_accept(*socket, [this, socket](const boost::system::error_code &error) {
-        handle_accept(socket, error);
-    });
+PubSubServer::~PubSubServer() {
+    if (!local_path_.empty()) {
+        boost::system::error_code ec;
+        local_acceptor_.close(ec);
+        ::unlink(local_path_.c_str());
+    }
 }
 
-void PubSubServer::handle_accept(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-                                 const boost::system::error_code &error) {
-    if (!error) {
-        BOOST_LOG_TRIVIAL(debug) << "[server] New client connected";
+bool PubSubServer::listen_local(const std::string &path) {
+    const boost::asio::local::stream_protocol::endpoint endpoint(path);
 
-        // Create a buffer for the client
-        auto client_buffer = std::make_shared<std::string>();
-        auto read_buffer = std::make_shared<std::array<char, 1024>>();
+    // A file left by a server that did not shut down cleanly makes bind fail
+    ::unlink(path.c_str());
 
-        // Start reading from the client
-        socket->async_read_some(boost::asio::buffer(*read_buffer),
-                                [this, socket, client_buffer, read_buffer](const boost::system::error_code &error,
-                                                                           std::size_t bytes_transferred) {
-                                    handle_read(socket, client_buffer, read_buffer, error, bytes_transferred);
-                                });
+    boost::system::error_code ec;
+    local_acceptor_.open(endpoint.protocol(), ec);
+    if (!ec) {
+        local_acceptor_.bind(endpoint, ec);
+    }
+    if (!ec) {
+        local_acceptor_.listen(boost::asio::socket_base::max_listen_connections, ec);
+    }
+    if (ec) {
+        BOOST_LOG_TRIVIAL(error) << "[server] Can not listen on " << path << ": " << ec.message();
+        local_acceptor_.close(ec);
+        return false;
+    }
+
+    local_path_ = path;
+    BOOST_LOG_TRIVIAL(info) << "[server] Listening on Unix socket " << path;
+    boost::asio::co_spawn(local_acceptor_.get_executor(), accept_loop(local_acceptor_), rethrow_on_error);
+    return true;
+}
 
-        // Accept the next client
-        start_accept();
-    } else {
-        BOOST_LOG_TRIVIAL(error) << "[server] Error accepting connection: " << error.message();
+void PubSubServer::set_shared_memory_spin(std::chrono::microseconds spin) {
+    shm_spin_ = spin;
+}
+
+TopicManager &PubSubServer::topic_manager() {
+    return *topic_manager_;
+}
+
+ServerStats &PubSubServer::stats() {
+    return *stats_;
+}
+
+template <typename Acceptor>
+boost::asio::awaitable<void> PubSubServer::accept_loop(Acceptor &acceptor) {
+    boost::system::error_code error;
+    for (;;) {
+        BOOST_LOG_TRIVIAL(debug) << "[server] Waiting for new connection...";
+        auto socket = co_await acceptor.async_accept(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if (error) {
+            BOOST_LOG_TRIVIAL(error) << "[server] Error accepting connection: " << error.message();
+            co_return;
+        }
+        // The connection counts its writes in this worker's traffic
+        handle_accept(std::make_shared<Connection>(std::move(socket),
+                                                   std::shared_ptr<TrafficCounters>(worker_, &worker_->traffic)));
     }
 }
 
-void PubSubServer::handle_read(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-                               std::shared_ptr<std::string> client_buffer,
-                               std::shared_ptr<std::array<char, 1024>> read_buffer,
-                               const boost::system::error_code &error, std::size_t bytes_transferred) {
-    if (!error) {
-        // Append the received data to the client buffer
-        client_buffer->append(read_buffer->data(), bytes_transferred);
+void PubSubServer::handle_accept(ConnectionSPtr connection) {
+    BOOST_LOG_TRIVIAL(debug) << "[server] New client connected";
+    add_local(worker_->traffic.connections_accepted);
+    add_local(worker_->traffic.connections);
+    {
+        std::lock_guard lock(worker_->mutex);
+        worker_->connections.insert(connection);
+    }
 
-        // Check if the buffer contains a complete message (delimited by std::endl)
-        std::size_t delimiter_pos = client_buffer->find(Message::kDelim);
-        while (delimiter_pos != std::string::npos) {
-            // Extract the complete message
-            std::string message = client_buffer->substr(0, delimiter_pos);
-            client_buffer->erase(0, delimiter_pos + 1);  // Remove the processed message from the buffer
+    // Start reading from the client
+    auto executor = connection->socket().get_executor();
+    boost::asio::co_spawn(executor, session(std::move(connection)), rethrow_on_error);
+}
 
-            // Log and process the message
-            BOOST_LOG_TRIVIAL(debug) << "[server] Received message: " << message;
-            process_message(socket, message);
+boost::asio::awaitable<void> PubSubServer::session(ConnectionSPtr connection) {
+    ReadBuffer buffer;
+    boost::system::error_code error;
+    while (!connection->channel()) {
+        const std::size_t bytes_transferred = co_await connection->socket().async_read_some(
+            buffer.prepare(), boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if (error) {
+            BOOST_LOG_TRIVIAL(error) << "[server] Error reading from client: " << error.message();
+            handle_disconnect(connection);
+            co_return;
+        }
 
-            // Look for the next message in the buffer
-            delimiter_pos = client_buffer->find(Message::kDelim);
+        buffer.commit(bytes_transferred);
+        add_local(worker_->traffic.bytes_in, bytes_transferred);
+        process_frames(connection, buffer);
+        if (!connection->is_open()) {
+            // DISCONNECT or a slow consumer policy, reading on would only fail
+            handle_disconnect(connection);
+            co_return;
+        }
+    }
+    co_await shared_memory_session(std::move(connection));
+}
+
+void PubSubServer::process_frames(const ConnectionSPtr &connection, ReadBuffer &buffer) {
+    const bool shared_memory = connection->channel() != nullptr;
+
+    // Process every complete frame in place, the protocol may change after CONNECT
+    std::string_view pending = buffer.data();
+    std::string_view frame;
+    std::size_t frame_size = Message::next_frame(pending, connection->protocol(), frame);
+    while (frame_size != 0) {
+        if (frame_size == Message::kFrameTooLarge) {
+            BOOST_LOG_TRIVIAL(error) << "[server] Frame exceeds " << Message::kMaxFrameSize
+                                     << " bytes, closing the connection";
+            // The session sees the closed connection and disconnects it
+            connection->close();
+            pending = {};
+            break;
         }
 
-        // Continue reading from the client
-        socket->async_read_some(boost::asio::buffer(*read_buffer),
-                                [this, socket, client_buffer, read_buffer](const boost::system::error_code &error,
-                                                                           std::size_t bytes_transferred) {
-                                    handle_read(socket, client_buffer, read_buffer, error, bytes_transferred);
-                                });
-    } else {
-        BOOST_LOG_TRIVIAL(error) << "[server] Error reading from client: " << error.message();
-        handle_disconnect(socket);
+        // Log and process the message
+        PUBSUB_LOG(trace) << "[server] Received message: " << frame;
+        add_local(worker_->traffic.frames_in);
+        process_message(connection, frame);
+
+        // Look for the next message in the buffer
+        pending.remove_prefix(frame_size);
+        if ((connection->channel() != nullptr) != shared_memory || !connection->is_open()) {
+            pending = {};
+            break;
+        }
+        frame_size = Message::next_frame(pending, connection->protocol(), frame);
     }
+    // Drop the processed messages, an incomplete frame stays for the next read
+    buffer.consume(buffer.data().size() - pending.size());
 }
 
-void PubSubServer::handle_disconnect(std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
-    topic_manager_.unsubscribe_all(socket);
+void PubSubServer::attach_shared_memory(const ConnectionSPtr &connection, std::string_view ring_bytes) {
+    // Only a client on this host can share memory
+    auto &socket = connection->socket();
+    boost::system::error_code ec;
+    if (socket.local_endpoint(ec).protocol().family() != AF_UNIX || ec) {
+        BOOST_LOG_TRIVIAL(error) << "[server] Shared memory requested over a remote connection";
+        handle_disconnect(connection);
+        return;
+    }
 
-    // Close the socket
-    if (socket->is_open()) {
-        boost::system::error_code ec;
-        socket->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-        if (ec) {
-            BOOST_LOG_TRIVIAL(error) << "[server] Error shutting down socket: " << ec.message();
+    std::size_t size{0};
+    const auto result = std::from_chars(ring_bytes.data(), ring_bytes.data() + ring_bytes.size(), size);
+    if (result.ec != std::errc() || result.ptr != ring_bytes.data() + ring_bytes.size()) {
+        BOOST_LOG_TRIVIAL(error) << "[server] Invalid shared memory ring size " << ring_bytes;
+        handle_disconnect(connection);
+        return;
+    }
+
+    // The segment is ours and sealed, the client can write to it but not resize it
+    auto channel = ShmChannel::create(size);
+    const int fd = channel ? channel->fd() : -1;
+    if (!channel || !connection->attach(std::move(channel)) || !send_descriptor(socket.native_handle(), fd)) {
+        BOOST_LOG_TRIVIAL(error) << "[server] Can not set up shared memory";
+        handle_disconnect(connection);
+        return;
+    }
+    BOOST_LOG_TRIVIAL(info) << "[server] Client moved to shared memory";
+}
+
+boost::asio::awaitable<void> PubSubServer::shared_memory_session(ConnectionSPtr connection) {
+    ReadBuffer buffer;
+    std::array<char, 64> doorbells;
+    boost::system::error_code error;
+    auto idle_since = std::chrono::steady_clock::now();
+    while (connection->is_open()) {
+        if (!service_shared_memory(connection, buffer, idle_since)) {
+            // Still busy or spinning, let the rest of the worker run first
+            co_await boost::asio::post(connection->socket().get_executor(), boost::asio::use_awaitable);
+            continue;
         }
-        socket->close(ec);
-        if (ec) {
-            BOOST_LOG_TRIVIAL(error) << "[server] Error closing socket: " << ec.message();
+
+        // Parked, the next doorbell brings us back
+        co_await connection->socket().async_read_some(boost::asio::buffer(doorbells),
+                                                      boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        idle_since = std::chrono::steady_clock::now();
+        if (error) {
+            // Frames the client wrote before it went away, like its DISCONNECT, are still processed
+            service_shared_memory(connection, buffer, idle_since);
+            if (connection->is_open()) {
+                BOOST_LOG_TRIVIAL(error) << "[server] Error reading from client: " << error.message();
+            }
+            break;
         }
     }
+    // Also after a DISCONNECT, a failed write or a slow consumer policy closed the connection
+    handle_disconnect(connection);
+}
+
+bool PubSubServer::service_shared_memory(const ConnectionSPtr &connection, ReadBuffer &buffer,
+                                         std::chrono::steady_clock::time_point &idle_since) {
+    auto *channel = connection->channel();
+    if (!connection->is_open()) {
+        return false;
+    }
+    channel->wake();
+
+    std::size_t bytes{0};
+    for (int i = 0; i < kShmReadsPerTurn && connection->is_open(); ++i) {
+        const auto space = buffer.prepare();
+        const auto read = channel->inbound().read(static_cast<char *>(space.data()), space.size());
+        if (read == 0) {
+            break;
+        }
+        bytes += read;
+        buffer.commit(read);
+        add_local(worker_->traffic.bytes_in, read);
+        process_frames(connection, buffer);
+    }
+    if (!connection->is_open()) {
+        return false;
+    }
+    if (bytes != 0) {
+        // The client may be waiting for room
+        channel->notify_peer(connection->socket().native_handle());
+    }
+    connection->resume();
+
+    const auto now = std::chrono::steady_clock::now();
+    if (bytes != 0) {
+        idle_since = now;
+    }
+    return bytes == 0 && now - idle_since >= shm_spin_ && channel->park(connection->write_pending());
+}
+
+void PubSubServer::handle_disconnect(std::shared_ptr<Connection> connection) {
+    {
+        // Runs once per connection, whichever of the frame, the session or an error gets here first
+        std::lock_guard lock(worker_->mutex);
+        if (worker_->connections.erase(connection) == 0) {
+            return;
+        }
+    }
+    sub_local(worker_->traffic.connections);
+    topic_manager_->unsubscribe_all(connection);
+    for (const auto topic_id : connection->clear_topic_aliases()) {
+        topic_manager_->release(topic_id);
+    }
+
+    // Close the socket
+    connection->close();
 
     BOOST_LOG_TRIVIAL(info) << "[server] Client disconnected and unsubscribed from all topics";
 }
 
-void PubSubServer::process_message(std::shared_ptr<boost::asio::ip::tcp::socket> socket, const std::string &message) {
-    Message msg = Message::deserialize(message);
+void PubSubServer::process_message(std::shared_ptr<Connection> connection, std::string_view message) {
+    // Views into the read buffer, nothing is copied unless a subscription is stored
+    StageTimer parse_timer(worker_->traffic, worker_->traffic.parse);
+    const MessageView msg = MessageView::parse(message, connection->protocol());
+    parse_timer.stop();
 
     // Handle the message based on its type
     switch (msg.type) {
         case MessageType::CONNECT:
             BOOST_LOG_TRIVIAL(info) << "[server] Client connected: " << msg.data;
+            if (msg.version != ProtocolVersion::TEXT) {
+                negotiate_protocol(connection, msg.version, msg.capabilities);
+            }
             break;
 
         case MessageType::DISCONNECT:
             BOOST_LOG_TRIVIAL(info) << "[server] Client disconnected";
-            handle_disconnect(socket);
+            handle_disconnect(connection);
             break;
 
         case MessageType::SUBSCRIBE:
-            BOOST_LOG_TRIVIAL(info) << "[server] Client subscribed to topic: " << msg.topic;
-            topic_manager_.subscribe(msg.topic, socket);
+            PUBSUB_LOG(debug) << "[server] Client subscribed to topic: " << msg.topic;
+            topic_manager_->subscribe(msg.topic, connection, msg.offset);
             break;
 
         case MessageType::UNSUBSCRIBE:
-            BOOST_LOG_TRIVIAL(info) << "[server] Client unsubscribed from topic: " << msg.topic;
-            topic_manager_.unsubscribe(msg.topic, socket);
+            PUBSUB_LOG(debug) << "[server] Client unsubscribed from topic: " << msg.topic;
+            topic_manager_->unsubscribe(msg.topic, connection);
             break;
 
-        case MessageType::PUBLISH:
-            BOOST_LOG_TRIVIAL(info) << "[server] Publishing message to topic: " << msg.topic;
-            topic_manager_.publish(msg.topic, msg.data);
+        case MessageType::PUBLISH: {
+            StageTimer route_timer(worker_->traffic, worker_->traffic.route);
+            std::string_view data = msg.data;
+            std::string_view compressed;
+            if (msg.compressed) {
+                // Inflated once here, subscribers that accepted compression get the publisher's bytes
+                if (!connection->compression() || !compression::decompress(msg.data, inflated_)) {
+                    BOOST_LOG_TRIVIAL(error) << "[server] Dropping publish with invalid compressed data";
+                    break;
+                }
+                data = inflated_;
+                compressed = msg.data;
+            }
+            if (msg.alias != kNoTopicAlias) {
+                publish_aliased(connection, msg, data, compressed);
+                break;
+            }
+            PUBSUB_LOG(trace) << "[server] Publishing message to topic: " << msg.topic;
+            topic_manager_->publish(msg.topic, data, compressed);
+            break;
+        }
+
+        case MessageType::STATS:
+            BOOST_LOG_TRIVIAL(debug) << "[server] Client requested stats";
+            send_stats(connection);
+            break;
+
+        case MessageType::SHM:
+            attach_shared_memory(connection, msg.data);
             break;
 
         default:
@@ -161,4 +391,54 @@ void PubSubServer::process_message(std::shared_ptr<boost::asio::ip::tcp::socket>
     }
 }
 
+void PubSubServer::publish_aliased(const std::shared_ptr<Connection> &connection, const MessageView &msg,
+                                   std::string_view data, std::string_view compressed) {
+    TopicManager::TopicId topic_id;
+    if (!msg.topic.empty()) {
+        // First use, remember the alias so later publishes can skip the name
+        TopicManager::TopicId previous;
+        const bool redefined = connection->topic_alias(msg.alias, previous);
+        topic_id = topic_manager_->intern(msg.topic);
+        connection->set_topic_alias(msg.alias, topic_id);
+        if (redefined) {
+            topic_manager_->release(previous);
+        }
+    } else if (!connection->topic_alias(msg.alias, topic_id)) {
+        BOOST_LOG_TRIVIAL(error) << "[server] Publish through undefined topic alias: " << msg.alias;
+        return;
+    }
+
+    PUBSUB_LOG(trace) << "[server] Publishing message to topic id: " << topic_id;
+    topic_manager_->publish(topic_id, data, compressed);
+}
+
+void PubSubServer::send_stats(const std::shared_ptr<Connection> &connection) {
+    const std::string stats = stats_->snapshot(*topic_manager_).format();
+
+    MessageView reply;
+    reply.type = MessageType::STATS;
+    reply.data = stats;
+    connection->send(make_frame(reply, connection->protocol()));
+}
+
+void PubSubServer::negotiate_protocol(std::shared_ptr<Connection> connection, ProtocolVersion requested,
+                                      std::uint8_t capabilities) {
+    // Unknown versions fall back to text, the client learns it from the CONNACK
+    Message ack;
+    ack.type = MessageType::CONNACK;
+    ack.version = requested == ProtocolVersion::BINARY ? ProtocolVersion::BINARY : ProtocolVersion::TEXT;
+    // Compressed data needs binary safe frames
+    if (ack.version == ProtocolVersion::BINARY && topic_manager_->compression_threshold() != 0) {
+        ack.capabilities = capabilities & Message::kCapabilityCompression;
+    }
+
+    // The acknowledgement itself is still text, everything after it uses the new version
+    connection->send(make_frame(ack.view(), ProtocolVersion::TEXT));
+    connection->set_protocol(ack.version);
+    connection->set_compression(ack.capabilities & Message::kCapabilityCompression);
+
+    BOOST_LOG_TRIVIAL(info) << "[server] Negotiated protocol version " << static_cast<int>(ack.version)
+                            << (connection->compression() ? " with compression" : "");
+}
+
 }  // namespace pubsub::server
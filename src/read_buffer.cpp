@@ -0,0 +1,58 @@
+#include "read_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace pubsub {
+
+boost::asio::mutable_buffer ReadBuffer::prepare() {
+    if (storage_.size() - end_ < read_size_) {
+        // Reuse the consumed space at the front before growing
+        if (begin_ > 0) {
+            std::memmove(storage_.data(), storage_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (storage_.size() - end_ < read_size_) {
+            storage_.resize(std::max(storage_.size() * 2, end_ + read_size_));
+        }
+    }
+    return boost::asio::buffer(storage_.data() + end_, read_size_);
+}
+
+void ReadBuffer::commit(std::size_t bytes) {
+    end_ += bytes;
+
+    if (bytes == read_size_ && read_size_ < kMaxReadSize) {
+        read_size_ *= 2;
+    } else if (bytes < read_size_ / 4 && read_size_ > kMinReadSize) {
+        read_size_ /= 2;
+    }
+}
+
+std::string_view ReadBuffer::data() const {
+    return std::string_view(storage_.data() + begin_, end_ - begin_);
+}
+
+void ReadBuffer::consume(std::size_t bytes) {
+    begin_ += bytes;
+    if (begin_ != end_) {
+        return;
+    }
+
+    // Everything consumed, start over at the front without moving anything
+    begin_ = end_ = 0;
+    // Give back the space an unusually large frame needed
+    if (storage_.size() > 4 * kMaxReadSize) {
+        std::vector<char>().swap(storage_);
+    }
+}
+
+std::size_t ReadBuffer::read_size() const {
+    return read_size_;
+}
+
+std::size_t ReadBuffer::capacity() const {
+    return storage_.size();
+}
+
+}  // namespace pubsub
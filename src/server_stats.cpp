@@ -0,0 +1,119 @@
+#include "server_stats.h"
+
+#include <algorithm>
+
+#include "connection.h"
+#include "topic_manager.h"
+
+namespace pubsub {
+
+namespace {
+
+void add_histogram(StatsSnapshot::Histogram &total, const StageHistogram &histogram) {
+    for (std::size_t i = 0; i < total.buckets.size(); ++i) {
+        total.buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+    }
+    total.sum_ns += histogram.sum_ns.load(std::memory_order_relaxed);
+}
+
+}  // namespace
+
+void StageHistogram::record(std::chrono::steady_clock::duration duration) {
+    const auto ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    const auto bucket = std::lower_bound(kStageBucketBounds.begin(), kStageBucketBounds.end(), ns) -
+                        kStageBucketBounds.begin();
+    add_local(buckets[bucket]);
+    add_local(sum_ns, ns);
+}
+
+std::string StatsSnapshot::format() const {
+    std::string out;
+    const auto add = [&out](const char *key, std::uint64_t value) {
+        if (!out.empty()) {
+            out.push_back(' ');
+        }
+        out.append(key).append("=").append(std::to_string(value));
+    };
+
+    add("frames_in", frames_in);
+    add("bytes_in", bytes_in);
+    add("frames_out", frames_out);
+    add("bytes_out", bytes_out);
+    add("write_errors", write_errors);
+    add("connections_accepted", connections_accepted);
+    add("connections", connections);
+    add("topics", topics);
+    add("subscriptions", subscriptions);
+    add("unrouted_publishes", unrouted_publishes);
+    add("dropped_newest", dropped_newest);
+    add("dropped_oldest", dropped_oldest);
+    add("slow_consumer_disconnects", slow_consumer_disconnects);
+    for (const auto &queue : queues) {
+        out.append(" queue=")
+            .append(queue.peer)
+            .append(",")
+            .append(std::to_string(queue.frames))
+            .append(",")
+            .append(std::to_string(queue.bytes));
+    }
+    return out;
+}
+
+std::shared_ptr<ServerStats::Worker> ServerStats::add_worker() {
+    auto worker = std::make_shared<Worker>();
+    std::lock_guard lock(mutex_);
+    worker->traffic.timing.store(timing_, std::memory_order_relaxed);
+    workers_.push_back(worker);
+    return worker;
+}
+
+void ServerStats::set_timing(bool enabled) {
+    std::lock_guard lock(mutex_);
+    timing_ = enabled;
+    for (const auto &worker : workers_) {
+        worker->traffic.timing.store(enabled, std::memory_order_relaxed);
+    }
+}
+
+StatsSnapshot ServerStats::totals(const TopicManager &topic_manager) const {
+    StatsSnapshot snapshot;
+    {
+        // Only contended by adding a worker
+        std::lock_guard lock(mutex_);
+        for (const auto &worker : workers_) {
+            const auto &traffic = worker->traffic;
+            snapshot.frames_in += traffic.frames_in.load(std::memory_order_relaxed);
+            snapshot.bytes_in += traffic.bytes_in.load(std::memory_order_relaxed);
+            snapshot.frames_out += traffic.frames_out.load(std::memory_order_relaxed);
+            snapshot.bytes_out += traffic.bytes_out.load(std::memory_order_relaxed);
+            snapshot.write_errors += traffic.write_errors.load(std::memory_order_relaxed);
+            snapshot.connections_accepted += traffic.connections_accepted.load(std::memory_order_relaxed);
+            snapshot.connections += traffic.connections.load(std::memory_order_relaxed);
+            snapshot.queued_frames += traffic.queued_frames.load(std::memory_order_relaxed);
+            snapshot.queued_bytes += traffic.queued_bytes.load(std::memory_order_relaxed);
+            add_histogram(snapshot.parse, traffic.parse);
+            add_histogram(snapshot.route, traffic.route);
+            add_histogram(snapshot.write, traffic.write);
+        }
+    }
+    topic_manager.add_stats(snapshot);
+    return snapshot;
+}
+
+StatsSnapshot ServerStats::snapshot(const TopicManager &topic_manager) const {
+    StatsSnapshot snapshot = totals(topic_manager);
+    std::vector<std::shared_ptr<Worker>> workers;
+    {
+        std::lock_guard lock(mutex_);
+        workers = workers_;
+    }
+    for (const auto &worker : workers) {
+        std::lock_guard lock(worker->mutex);
+        for (const auto &connection : worker->connections) {
+            snapshot.queues.push_back({connection->peer(), connection->queue_depth(), connection->queued_bytes()});
+        }
+    }
+    return snapshot;
+}
+
+}  // namespace pubsub
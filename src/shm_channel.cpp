@@ -0,0 +1,240 @@
+#include "shm_channel.h"
+#include <boost/log/trivial.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+namespace pubsub {
+
+namespace {
+
+constexpr std::uint64_t kMagic{0x70756273756273ULL};  // "pubsubs"
+// The client can not resize the segment under the server, nor lift the seals
+constexpr int kSeals{F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "ring positions must be lock-free");
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "park flags must be lock-free");
+
+bool valid_ring_bytes(std::uint64_t ring_bytes) {
+    return ring_bytes >= ShmChannel::kMinRingBytes && ring_bytes <= ShmChannel::kMaxRingBytes &&
+           (ring_bytes & (ring_bytes - 1)) == 0;
+}
+
+}  // namespace
+
+ShmRing::ShmRing(ShmRingIndex &index, char *data, std::size_t capacity)
+    : index_(index), data_(data), capacity_(capacity) {}
+
+std::size_t ShmRing::write(const char *data, std::size_t size) {
+    const auto head = index_.head.load(std::memory_order_relaxed);
+    const auto used = head - index_.tail.load(std::memory_order_acquire);
+    // A peer that corrupted its position only stalls its own stream
+    if (used >= capacity_) {
+        return 0;
+    }
+
+    const auto bytes = std::min<std::size_t>(size, capacity_ - used);
+    const auto offset = static_cast<std::size_t>(head & (capacity_ - 1));
+    const auto first = std::min(bytes, capacity_ - offset);
+    std::memcpy(data_ + offset, data, first);
+    std::memcpy(data_, data + first, bytes - first);
+    index_.head.store(head + bytes, std::memory_order_release);
+    return bytes;
+}
+
+std::size_t ShmRing::read(char *data, std::size_t size) {
+    const auto tail = index_.tail.load(std::memory_order_relaxed);
+    const auto available = index_.head.load(std::memory_order_acquire) - tail;
+    if (available == 0 || available > capacity_) {
+        return 0;
+    }
+
+    const auto bytes = std::min<std::size_t>(size, available);
+    const auto offset = static_cast<std::size_t>(tail & (capacity_ - 1));
+    const auto first = std::min(bytes, capacity_ - offset);
+    std::memcpy(data, data_ + offset, first);
+    std::memcpy(data + first, data_, bytes - first);
+    index_.tail.store(tail + bytes, std::memory_order_release);
+    return bytes;
+}
+
+bool ShmRing::readable() const {
+    const auto available = index_.head.load(std::memory_order_acquire) - index_.tail.load(std::memory_order_relaxed);
+    return available != 0 && available <= capacity_;
+}
+
+bool ShmRing::writable() const {
+    return index_.head.load(std::memory_order_relaxed) - index_.tail.load(std::memory_order_acquire) < capacity_;
+}
+
+std::size_t ShmRing::capacity() const {
+    return capacity_;
+}
+
+struct ShmChannel::Header {
+    std::uint64_t magic;
+    std::uint64_t ring_bytes;
+    alignas(64) std::atomic<std::uint32_t> server_parked{0};
+    alignas(64) std::atomic<std::uint32_t> client_parked{0};
+    ShmRingIndex to_server;
+    ShmRingIndex to_client;
+};
+
+std::unique_ptr<ShmChannel> ShmChannel::create(std::size_t ring_bytes) {
+    std::size_t rounded{kMinRingBytes};
+    while (rounded < ring_bytes && rounded < kMaxRingBytes) {
+        rounded *= 2;
+    }
+
+    const int fd = ::memfd_create("pubsub-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        BOOST_LOG_TRIVIAL(error) << "[shm] Can not create segment: " << std::strerror(errno);
+        return nullptr;
+    }
+    const std::size_t size = sizeof(Header) + 2 * rounded;
+    void *memory = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(size)) == 0 && ::fcntl(fd, F_ADD_SEALS, kSeals) == 0) {
+        memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (memory == MAP_FAILED) {
+        BOOST_LOG_TRIVIAL(error) << "[shm] Can not set up segment: " << std::strerror(errno);
+        ::close(fd);
+        return nullptr;
+    }
+
+    auto *header = new (memory) Header{};
+    header->magic = kMagic;
+    header->ring_bytes = rounded;
+    return std::unique_ptr<ShmChannel>(new ShmChannel(fd, memory, size, rounded, true));
+}
+
+std::unique_ptr<ShmChannel> ShmChannel::open(int fd) {
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(Header)) {
+        BOOST_LOG_TRIVIAL(error) << "[shm] Segment is too small";
+        ::close(fd);
+        return nullptr;
+    }
+
+    const auto size = static_cast<std::size_t>(st.st_size);
+    void *memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        BOOST_LOG_TRIVIAL(error) << "[shm] Can not map segment: " << std::strerror(errno);
+        ::close(fd);
+        return nullptr;
+    }
+
+    const auto *header = static_cast<const Header *>(memory);
+    const std::uint64_t ring_bytes = header->ring_bytes;
+    if (header->magic != kMagic || !valid_ring_bytes(ring_bytes) || sizeof(Header) + 2 * ring_bytes > size) {
+        BOOST_LOG_TRIVIAL(error) << "[shm] Segment has an invalid header";
+        ::munmap(memory, size);
+        ::close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<ShmChannel>(new ShmChannel(fd, memory, size, ring_bytes, false));
+}
+
+ShmChannel::ShmChannel(int fd, void *memory, std::size_t size, std::size_t ring_bytes, bool server)
+    : fd_(fd),
+      memory_(memory),
+      size_(size),
+      header_(static_cast<Header *>(memory)),
+      parked_(server ? header_->server_parked : header_->client_parked),
+      peer_parked_(server ? header_->client_parked : header_->server_parked),
+      inbound_(server ? header_->to_server : header_->to_client,
+               static_cast<char *>(memory) + sizeof(Header) + (server ? 0 : ring_bytes), ring_bytes),
+      outbound_(server ? header_->to_client : header_->to_server,
+                static_cast<char *>(memory) + sizeof(Header) + (server ? ring_bytes : 0), ring_bytes) {}
+
+ShmChannel::~ShmChannel() {
+    ::munmap(memory_, size_);
+    ::close(fd_);
+}
+
+ShmRing &ShmChannel::inbound() {
+    return inbound_;
+}
+
+ShmRing &ShmChannel::outbound() {
+    return outbound_;
+}
+
+int ShmChannel::fd() const {
+    return fd_;
+}
+
+bool ShmChannel::park(bool pending_output) {
+    parked_.store(1, std::memory_order_relaxed);
+    // Pairs with the fence in notify_peer: either the peer sees the mark, or we see its ring update
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (inbound_.readable() || (pending_output && outbound_.writable())) {
+        parked_.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void ShmChannel::wake() {
+    parked_.store(0, std::memory_order_relaxed);
+}
+
+void ShmChannel::notify_peer(int socket) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (peer_parked_.load(std::memory_order_relaxed) == 0 || peer_parked_.exchange(0, std::memory_order_relaxed) == 0) {
+        return;
+    }
+    // A full socket buffer already holds doorbells the peer has not read
+    const char doorbell{0};
+    ::send(socket, &doorbell, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+bool send_descriptor(int socket, int fd) {
+    char byte{0};
+    iovec data{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    auto *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    return ::sendmsg(socket, &message, MSG_NOSIGNAL) == 1;
+}
+
+int receive_descriptor(int socket) {
+    char byte;
+    iovec data{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message{};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    const auto *header = CMSG_FIRSTHDR(&message);
+    if (received != 1 || !header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(sizeof(int))) {
+        return -1;
+    }
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    return fd;
+}
+
+}  // namespace pubsub
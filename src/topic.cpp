@@ -0,0 +1,68 @@
+#include "topic.h"
+
+namespace pubsub::topic {
+
+LevelIterator::LevelIterator(std::string_view topic) : rest_(topic) {}
+
+bool LevelIterator::next(std::string_view &level) {
+    if (done_) {
+        return false;
+    }
+
+    const std::size_t pos = rest_.find(kSeparator);
+    if (pos == std::string_view::npos) {
+        level = rest_;
+        done_ = true;
+    } else {
+        level = rest_.substr(0, pos);
+        rest_.remove_prefix(pos + 1);
+    }
+    return true;
+}
+
+bool is_filter(std::string_view topic) {
+    LevelIterator levels(topic);
+    std::string_view level;
+    while (levels.next(level)) {
+        if (level == kSingleLevelWildcard || level == kMultiLevelWildcard) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_valid_filter(std::string_view filter) {
+    LevelIterator levels(filter);
+    std::string_view level;
+    while (levels.next(level)) {
+        if (level == kMultiLevelWildcard) {
+            return !levels.next(level);
+        }
+    }
+    return true;
+}
+
+bool is_valid_name(std::string_view name) {
+    return !is_filter(name);
+}
+
+bool matches(std::string_view filter, std::string_view name) {
+    LevelIterator filter_levels(filter);
+    LevelIterator name_levels(name);
+    std::string_view filter_level;
+    std::string_view name_level;
+    while (filter_levels.next(filter_level)) {
+        if (filter_level == kMultiLevelWildcard) {
+            return true;
+        }
+        if (!name_levels.next(name_level)) {
+            return false;
+        }
+        if (filter_level != kSingleLevelWildcard && filter_level != name_level) {
+            return false;
+        }
+    }
+    return !name_levels.next(name_level);
+}
+
+}  // namespace pubsub::topic
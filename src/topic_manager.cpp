@@ -1,62 +1,648 @@
 #include "topic_manager.h"
 #include <boost/log/trivial.hpp>
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include "frame_pool.h"
+#include "logging.h"
 #include "message.h"
 
 namespace pubsub {
 
-void TopicManager::subscribe(const std::string &topic, std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
-    topics_[topic].insert(socket);
+TopicManager::TopicManager(std::size_t shard_count) : shards_(shard_count == 0 ? 1 : shard_count) {}
+
+std::size_t TopicManager::shard_index(std::string_view topic) const {
+    return std::hash<std::string_view>{}(topic) % shards_.size();
+}
+
+TopicManager::TopicId TopicManager::intern_locked(Shard &shard, std::size_t index, std::string_view topic) {
+    auto it = shard.slots.find(topic);
+    if (it == shard.slots.end()) {
+        std::uint32_t slot;
+        if (shard.free_slots.empty()) {
+            slot = static_cast<std::uint32_t>(shard.topics.size());
+            shard.topics.emplace_back();
+        } else {
+            slot = shard.free_slots.back();
+            shard.free_slots.pop_back();
+        }
+        auto &entry = shard.topics[slot];
+        entry.name = topic;
+        it = shard.slots.emplace(entry.name, slot).first;
+    }
+    return static_cast<TopicId>(it->second * shards_.size() + index);
+}
+
+// Free the slot of a topic nothing refers to anymore, called with the shard
+// locked exclusively
+void TopicManager::reclaim(Shard &shard, std::uint32_t slot) {
+    auto &topic = shard.topics[slot];
+    if (topic.name.empty() || !topic.subscribers.empty() || !topic.replays.empty() || topic.pins > 0 ||
+        topic.limits || topic.log) {
+        return;
+    }
+    shard.slots.erase(topic.name);
+    topic.name.clear();
+    topic.messages.store(0, std::memory_order_relaxed);
+    shard.free_slots.push_back(slot);
+}
+
+TopicManager::TopicId TopicManager::intern(std::string_view topic) {
+    const auto index = shard_index(topic);
+    auto &shard = shards_[index];
+    std::unique_lock lock(shard.mutex);
+    const auto id = intern_locked(shard, index, topic);
+    ++shard.topics[id / shards_.size()].pins;
+    return id;
+}
+
+void TopicManager::release(TopicId topic) {
+    auto &shard = shards_[topic % shards_.size()];
+    const auto slot = static_cast<std::uint32_t>(topic / shards_.size());
+    std::unique_lock lock(shard.mutex);
+    if (slot >= shard.topics.size() || shard.topics[slot].pins == 0) {
+        BOOST_LOG_TRIVIAL(warning) << "[topic_manager] Release of a topic id not interned: " << topic;
+        return;
+    }
+    --shard.topics[slot].pins;
+    reclaim(shard, slot);
+}
+
+void TopicManager::set_default_limits(const OutboundLimits &limits) {
+    default_limits_ = limits;
+}
+
+void TopicManager::set_topic_limits(std::string_view topic, const OutboundLimits &limits) {
+    const auto index = shard_index(topic);
+    auto &shard = shards_[index];
+    std::unique_lock lock(shard.mutex);
+    const auto id = intern_locked(shard, index, topic);
+    shard.topics[id / shards_.size()].limits = limits;
+}
+
+const SlowConsumerCounters &TopicManager::slow_consumer_counters() const {
+    return slow_consumer_counters_;
+}
+
+void TopicManager::add_stats(StatsSnapshot &snapshot) const {
+    snapshot.topics = active_topics_.load(std::memory_order_relaxed);
+    snapshot.subscriptions = subscription_count_.load(std::memory_order_relaxed);
+    snapshot.unrouted_publishes = unrouted_publishes_.load(std::memory_order_relaxed);
+    snapshot.dropped_newest = slow_consumer_counters_.dropped_newest.load(std::memory_order_relaxed);
+    snapshot.dropped_oldest = slow_consumer_counters_.dropped_oldest.load(std::memory_order_relaxed);
+    snapshot.slow_consumer_disconnects = slow_consumer_counters_.disconnects.load(std::memory_order_relaxed);
+}
+
+void TopicManager::visit_message_counts(const std::function<void(TopicId, std::uint64_t)> &visitor) {
+    for (std::size_t index = 0; index < shards_.size(); ++index) {
+        auto &shard = shards_[index];
+        std::shared_lock lock(shard.mutex);
+        for (std::size_t slot = 0; slot < shard.topics.size(); ++slot) {
+            if (const auto messages = shard.topics[slot].messages.load(std::memory_order_relaxed); messages > 0) {
+                visitor(static_cast<TopicId>(slot * shards_.size() + index), messages);
+            }
+        }
+    }
+}
+
+std::string TopicManager::topic_name(TopicId topic) {
+    auto &shard = shards_[topic % shards_.size()];
+    const std::size_t slot = topic / shards_.size();
+    std::shared_lock lock(shard.mutex);
+    return slot < shard.topics.size() ? shard.topics[slot].name : std::string();
+}
+
+void TopicManager::set_retained_budget(std::size_t bytes) {
+    retained_budget_ = bytes;
+}
+
+void TopicManager::retain(std::string_view topic, std::string_view data) {
+    const std::size_t size = topic.size() + data.size();
+    // Copied before locking, other shards publish through the same list
+    std::string value;
+    if (size <= retained_budget_) {
+        value = data;
+    }
+
+    std::lock_guard lock(retained_mutex_);
+    auto it = retained_index_.find(topic);
+    if (it != retained_index_.end()) {
+        retained_bytes_ -= it->second->topic.size() + it->second->data.size();
+        retained_.splice(retained_.begin(), retained_, it->second);
+        if (size > retained_budget_) {
+            // Too large to keep, and the previous value is stale now
+            retained_index_.erase(it);
+            retained_.pop_front();
+            return;
+        }
+        retained_.front().data.swap(value);
+    } else {
+        if (size > retained_budget_) {
+            return;
+        }
+        retained_.push_front(Retained{std::string(topic), std::move(value)});
+        retained_index_.emplace(retained_.front().topic, retained_.begin());
+    }
+    retained_bytes_ += size;
+
+    // Evict the least recently used values until the new one fits
+    while (retained_bytes_ > retained_budget_) {
+        const auto &last = retained_.back();
+        retained_bytes_ -= last.topic.size() + last.data.size();
+        retained_index_.erase(last.topic);
+        retained_.pop_back();
+    }
 }
 
-void TopicManager::unsubscribe(const std::string &topic, std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
-    auto it = topics_.find(topic);
-    if (it != topics_.end()) {
-        it->second.erase(socket);
-        if (it->second.empty()) {
-            topics_.erase(it);
+// Send the retained value of `topic`, called with its shard locked
+void TopicManager::send_retained(const Topic &topic, const std::shared_ptr<Connection> &connection) {
+    Connection::FrameSPtr frame;
+    {
+        std::lock_guard lock(retained_mutex_);
+        auto it = retained_index_.find(topic.name);
+        if (it == retained_index_.end()) {
+            return;
         }
+        MessageView msg;
+        msg.type = MessageType::PUBLISH;
+        msg.topic = topic.name;
+        msg.data = it->second->data;
+        frame = make_frame(msg, connection->protocol());
+        // Handing it out counts as a use
+        retained_.splice(retained_.begin(), retained_, it->second);
     }
+    connection->send(std::move(frame), topic.limits ? *topic.limits : default_limits_, slow_consumer_counters_);
 }
 
-void TopicManager::unsubscribe_all(std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
-    for (auto &topic_entry : topics_) {
-        topic_entry.second.erase(socket);
+// Send the retained values of every topic `filter` matches, called without
+// shard locks
+void TopicManager::send_retained_matching(std::string_view filter, const std::shared_ptr<Connection> &connection) {
+    const auto protocol = connection->protocol();
+    std::vector<std::pair<std::string, Connection::FrameSPtr>> frames;
+    {
+        std::lock_guard lock(retained_mutex_);
+        MessageView msg;
+        msg.type = MessageType::PUBLISH;
+        for (auto it = retained_.begin(); it != retained_.end();) {
+            const auto next = std::next(it);
+            if (topic::matches(filter, it->topic)) {
+                msg.topic = it->topic;
+                msg.data = it->data;
+                frames.emplace_back(it->topic, make_frame(msg, protocol));
+                retained_.splice(retained_.begin(), retained_, it);
+            }
+            it = next;
+        }
+    }
+
+    // Limits are looked up after, the retained list is never held across a shard lock
+    for (auto &[name, frame] : frames) {
+        auto &shard = shards_[shard_index(name)];
+        std::shared_lock lock(shard.mutex);
+        const auto slot = shard.slots.find(name);
+        const auto *topic = slot != shard.slots.end() ? &shard.topics[slot->second] : nullptr;
+        const OutboundLimits &limits = topic && topic->limits ? *topic->limits : default_limits_;
+        connection->send(std::move(frame), limits, slow_consumer_counters_);
     }
+}
 
-    // Optionally, remove topics that have no subscribers left
-    for (auto it = topics_.begin(); it != topics_.end();) {
-        if (it->second.empty()) {
-            it = topics_.erase(it);
+bool TopicManager::enable_log(std::string_view topic, MessageLog &log) {
+    auto topic_log = log.open(topic);
+    if (!topic_log) {
+        return false;
+    }
+
+    const auto index = shard_index(topic);
+    auto &shard = shards_[index];
+    std::unique_lock lock(shard.mutex);
+    const auto id = intern_locked(shard, index, topic);
+    shard.topics[id / shards_.size()].log = std::move(topic_log);
+    return true;
+}
+
+void TopicManager::subscribe(std::string_view topic, std::shared_ptr<Connection> connection,
+                             std::uint64_t replay_from) {
+    if (topic::is_filter(topic)) {
+        if (replay_from != kNoOffset) {
+            BOOST_LOG_TRIVIAL(warning) << "[topic_manager] Replay is not supported for wildcard filters: " << topic;
+        }
+        // Subscribing again does not send the retained values again
+        if (subscribe_wildcard(topic, connection) && retained_budget_ > 0) {
+            // Subscribed first, a concurrent publish may then arrive twice but is never missed
+            send_retained_matching(topic, connection);
+        }
+        return;
+    }
+
+    const auto index = shard_index(topic);
+    auto &shard = shards_[index];
+    std::shared_ptr<Replay> replay;
+    {
+        std::unique_lock lock(shard.mutex);
+        const auto id = intern_locked(shard, index, topic);
+        auto &entry = shard.topics[id / shards_.size()];
+        if (entry.replays.contains(connection)) {
+            // Joins the subscribers once it caught up
+            return;
+        }
+        shard.subscriptions[connection].insert(id);
+
+        if (replay_from != kNoOffset && !entry.log) {
+            BOOST_LOG_TRIVIAL(warning) << "[topic_manager] No log to replay for topic: " << topic;
+        }
+        if (replay_from != kNoOffset && entry.log && !entry.subscribers.contains(connection)) {
+            replay = std::make_shared<Replay>();
+            replay->connection = connection;
+            replay->topic = id;
+            replay->name = topic;
+            replay->log = entry.log;
+            replay->limits = entry.limits ? *entry.limits : default_limits_;
+            replay->cursor = std::make_unique<LogCursor>(*replay->log, replay_from);
+            entry.replays.emplace(connection, replay);
+            subscription_count_.fetch_add(1, std::memory_order_relaxed);
         } else {
-            ++it;
+            // Publishes to this topic wait for the lock, so the subscriber
+            // continues with live messages right after the retained one
+            if (replay_from == kNoOffset && retained_budget_ > 0 && !entry.subscribers.contains(connection)) {
+                send_retained(entry, connection);
+            }
+            if (entry.subscribers.insert(connection).second) {
+                subscription_count_.fetch_add(1, std::memory_order_relaxed);
+                if (entry.subscribers.size() == 1) {
+                    active_topics_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
         }
     }
+
+    if (replay) {
+        // Read on the connection's thread, which also learns when its queue drained
+        boost::asio::post(connection->socket().get_executor(), [this, replay]() { continue_replay(replay); });
+    }
 }
 
-void TopicManager::publish(const std::string &topic, const std::string &data) {
-    if (topics_.find(topic) == topics_.end()) {
-        BOOST_LOG_TRIVIAL(warning) << "[topic_manager] Topic not found: " << topic;
+// Called with the topic's shard locked exclusively
+void TopicManager::remove_subscriber(Topic &topic, const std::shared_ptr<Connection> &connection) {
+    if (auto replay = topic.replays.find(connection); replay != topic.replays.end()) {
+        replay->second->active.store(false, std::memory_order_relaxed);
+        topic.replays.erase(replay);
+        subscription_count_.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+    if (topic.subscribers.erase(connection) == 0) {
         return;
     }
+    subscription_count_.fetch_sub(1, std::memory_order_relaxed);
+    if (topic.subscribers.empty()) {
+        active_topics_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
 
-    for (auto &socket : topics_[topic]) {
-        if (socket->is_open()) {
-            Message msg;
-            msg.type = MessageType::PUBLISH;
-            msg.topic = topic;
-            msg.data = data;
+// One step of a replay, run on the connection's thread without shard locks.
+// Sends the next chunk and comes back once the queue drained. Caught up with
+// the log, it marks where live publishes start being held for it, reads up to
+// that mark and hands over to live delivery.
+void TopicManager::continue_replay(const std::shared_ptr<Replay> &replay) {
+    auto &connection = *replay->connection;
+    // Unsubscribed, or closed and about to be
+    if (!replay->active.load(std::memory_order_relaxed) || !connection.is_open()) {
+        return;
+    }
 
-            std::string message = msg.serialize();
-            BOOST_LOG_TRIVIAL(debug) << "[topic_manager] Publishing message to topic: " << topic;
-            boost::system::error_code ec;
-            boost::asio::write(*socket, boost::asio::buffer(message), ec);
+    const auto end = replay->handoff != kNoOffset ? replay->handoff : replay->log->next_offset();
+    const auto position = replay->cursor->position();
+    if (position < end) {
+        if (send_replay_chunk(*replay, end)) {
+            connection.on_drained([this, replay]() { continue_replay(replay); });
+            return;
+        }
+        // The log writer has not written the next record yet, it wakes the replay
+        // up. The connection's thread keeps running until then.
+        auto work = boost::asio::make_work_guard(connection.socket().get_executor());
+        replay->log->when_written(position + 1, [this, replay, work]() {
+            boost::asio::post(work.get_executor(), [this, replay]() { continue_replay(replay); });
+        });
+        return;
+    }
 
-            if (ec) {
-                BOOST_LOG_TRIVIAL(warning) << "[topic_manager] Write failed: " << ec.message();
+    if (replay->handoff == kNoOffset) {
+        auto &shard = shards_[replay->topic % shards_.size()];
+        {
+            std::unique_lock lock(shard.mutex);
+            if (!replay->active.load(std::memory_order_relaxed)) {
+                return;
+            }
+            replay->handoff = replay->log->next_offset();
+        }
+        // Publishes since the end of the last chunk are still to be read
+        continue_replay(replay);
+        return;
+    }
+
+    finish_replay(replay);
+}
+
+bool TopicManager::send_replay_chunk(Replay &replay, std::uint64_t end) {
+    // Chunks start on an empty queue, so half the limits leaves room for the
+    // frames of other topics
+    const std::uint64_t max_frames = std::clamp<std::size_t>(replay.limits.max_frames / 2, 1, kReplayChunkFrames);
+    const std::size_t max_bytes = std::clamp<std::size_t>(replay.limits.max_bytes / 2, 1, kReplayChunkBytes);
+    auto &cursor = *replay.cursor;
+    const auto position = cursor.position();
+
+    auto &connection = *replay.connection;
+    const auto protocol = connection.protocol();
+    MessageView msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = replay.name;
+    std::size_t bytes{0};
+    // Records lost by the writer are skipped, the cursor moves past them
+    cursor.read(std::min(end, position + max_frames), [&](std::uint64_t offset, std::string_view data) {
+        if (bytes > 0 && bytes + data.size() > max_bytes) {
+            return false;
+        }
+        bytes += data.size();
+        msg.data = data;
+        // Only the binary protocol carries the log offset
+        msg.offset = protocol == ProtocolVersion::BINARY ? offset : kNoOffset;
+        connection.send(make_frame(msg, protocol), replay.limits, slow_consumer_counters_);
+        return true;
+    });
+    return cursor.position() != position;
+}
+
+// Called with the topic's shard locked shared
+void TopicManager::hold(Replay &replay, const Connection::FrameSPtr &frame) {
+    const auto &limits = replay.limits;
+    std::lock_guard lock(replay.held_mutex);
+    if (replay.closing) {
+        return;
+    }
+    const auto over_limit = [&]() {
+        return replay.held.size() + 1 > limits.max_frames || replay.held_bytes + frame->size() > limits.max_bytes;
+    };
+
+    if (over_limit()) {
+        switch (limits.policy) {
+            case SlowConsumerPolicy::DROP_NEWEST:
+                slow_consumer_counters_.dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                return;
+
+            case SlowConsumerPolicy::DROP_OLDEST:
+                while (!replay.held.empty() && over_limit()) {
+                    replay.held_bytes -= replay.held.front()->size();
+                    replay.held.pop_front();
+                    slow_consumer_counters_.dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+                }
+                if (over_limit()) {
+                    slow_consumer_counters_.dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                break;
+
+            case SlowConsumerPolicy::DISCONNECT:
+                slow_consumer_counters_.disconnects.fetch_add(1, std::memory_order_relaxed);
+                BOOST_LOG_TRIVIAL(warning) << "[topic_manager] Replay fell too far behind, disconnecting subscriber";
+                replay.closing = true;
+                replay.held.clear();
+                replay.held_bytes = 0;
+                // Closed on its own thread, the replay then stops at its next step
+                boost::asio::post(replay.connection->socket().get_executor(),
+                                  [connection = replay.connection]() { connection->close(); });
+                return;
+        }
+    }
+    replay.held_bytes += frame->size();
+    replay.held.push_back(frame);
+}
+
+void TopicManager::finish_replay(const std::shared_ptr<Replay> &replay) {
+    auto &shard = shards_[replay->topic % shards_.size()];
+    std::unique_lock lock(shard.mutex);
+    if (!replay->active.load(std::memory_order_relaxed)) {
+        return;
+    }
+    auto &entry = shard.topics[replay->topic / shards_.size()];
+    const auto &connection = replay->connection;
+
+    // Publishes wait for the lock, nothing is held for the replay anymore after these
+    for (auto &frame : replay->held) {
+        connection->send(std::move(frame), replay->limits, slow_consumer_counters_);
+    }
+    replay->held.clear();
+    replay->held_bytes = 0;
+    replay->active.store(false, std::memory_order_relaxed);
+    entry.replays.erase(connection);
+    if (entry.subscribers.insert(connection).second && entry.subscribers.size() == 1) {
+        active_topics_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void TopicManager::unsubscribe(std::string_view topic, std::shared_ptr<Connection> connection) {
+    if (topic::is_filter(topic)) {
+        unsubscribe_wildcard(topic, connection);
+        return;
+    }
+
+    const auto index = shard_index(topic);
+    auto &shard = shards_[index];
+    std::unique_lock lock(shard.mutex);
+    auto it = shard.slots.find(topic);
+    if (it == shard.slots.end()) {
+        return;
+    }
+
+    if (auto subscription = shard.subscriptions.find(connection); subscription != shard.subscriptions.end()) {
+        subscription->second.erase(static_cast<TopicId>(it->second * shards_.size() + index));
+        if (subscription->second.empty()) {
+            shard.subscriptions.erase(subscription);
+        }
+    }
+    const auto slot = it->second;
+    remove_subscriber(shard.topics[slot], connection);
+    reclaim(shard, slot);
+}
+
+void TopicManager::unsubscribe_all(std::shared_ptr<Connection> connection) {
+    // Only the connection's own subscriptions are visited, not every topic
+    for (auto &shard : shards_) {
+        std::unique_lock lock(shard.mutex);
+        auto subscription = shard.subscriptions.find(connection);
+        if (subscription == shard.subscriptions.end()) {
+            continue;
+        }
+
+        for (const auto id : subscription->second) {
+            remove_subscriber(shard.topics[id / shards_.size()], connection);
+            reclaim(shard, static_cast<std::uint32_t>(id / shards_.size()));
+        }
+        shard.subscriptions.erase(subscription);
+    }
+
+    unsubscribe_all_wildcards(connection);
+}
+
+bool TopicManager::subscribe_wildcard(std::string_view filter, std::shared_ptr<Connection> connection) {
+    std::unique_lock lock(wildcard_mutex_);
+    if (!wildcard_subscriptions_[connection].emplace(filter).second) {
+        return false;
+    }
+    subscription_count_.fetch_add(1, std::memory_order_relaxed);
+    wildcards_.insert(filter, std::move(connection));
+    has_wildcards_.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void TopicManager::unsubscribe_wildcard(std::string_view filter, const std::shared_ptr<Connection> &connection) {
+    std::unique_lock lock(wildcard_mutex_);
+    if (!wildcards_.erase(filter, connection)) {
+        return;
+    }
+
+    auto subscription = wildcard_subscriptions_.find(connection);
+    subscription->second.erase(std::string(filter));
+    subscription_count_.fetch_sub(1, std::memory_order_relaxed);
+    if (subscription->second.empty()) {
+        wildcard_subscriptions_.erase(subscription);
+    }
+    has_wildcards_.store(!wildcards_.empty(), std::memory_order_relaxed);
+}
+
+void TopicManager::unsubscribe_all_wildcards(const std::shared_ptr<Connection> &connection) {
+    if (!has_wildcards_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::unique_lock lock(wildcard_mutex_);
+    auto subscription = wildcard_subscriptions_.find(connection);
+    if (subscription == wildcard_subscriptions_.end()) {
+        return;
+    }
+
+    for (const auto &filter : subscription->second) {
+        wildcards_.erase(filter, connection);
+    }
+    subscription_count_.fetch_sub(subscription->second.size(), std::memory_order_relaxed);
+    wildcard_subscriptions_.erase(subscription);
+    has_wildcards_.store(!wildcards_.empty(), std::memory_order_relaxed);
+}
+
+void TopicManager::set_compression_threshold(std::size_t bytes) {
+    compression_threshold_ = bytes;
+}
+
+std::size_t TopicManager::compression_threshold() const {
+    return compression_threshold_;
+}
+
+void TopicManager::publish(std::string_view topic, std::string_view data, std::string_view compressed) {
+    const auto index = shard_index(topic);
+    auto &shard = shards_[index];
+    std::shared_lock lock(shard.mutex);
+    if (retained_budget_ > 0) {
+        retain(topic, data);
+    }
+    auto it = shard.slots.find(topic);
+    deliver(topic, it != shard.slots.end() ? &shard.topics[it->second] : nullptr, data, compressed);
+}
+
+void TopicManager::publish(TopicId topic, std::string_view data, std::string_view compressed) {
+    auto &shard = shards_[topic % shards_.size()];
+    const std::size_t slot = topic / shards_.size();
+    std::shared_lock lock(shard.mutex);
+    if (slot >= shard.topics.size() || shard.topics[slot].name.empty()) {
+        BOOST_LOG_TRIVIAL(warning) << "[topic_manager] Unknown topic id: " << topic;
+        return;
+    }
+    const auto &entry = shard.topics[slot];
+    if (retained_budget_ > 0) {
+        retain(entry.name, data);
+    }
+    deliver(entry.name, &entry, data, compressed);
+}
+
+// Called with the shard of `topic` locked, `exact` is its entry if interned
+void TopicManager::deliver(std::string_view topic, const Topic *exact, std::string_view data,
+                           std::string_view compressed) {
+    const OutboundLimits &limits = exact && exact->limits ? *exact->limits : default_limits_;
+    // Logged even without subscribers, they may replay it later
+    const std::uint64_t offset = exact && exact->log ? exact->log->append(data) : kNoOffset;
+    if (exact) {
+        exact->messages.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (exact && exact->subscribers.empty() && exact->replays.empty()) {
+        exact = nullptr;
+    }
+
+    // Subscribers through wildcard filters, reused between publishes on this thread
+    thread_local std::vector<std::shared_ptr<Connection>> matched;
+    if (has_wildcards_.load(std::memory_order_relaxed)) {
+        std::shared_lock wildcard_lock(wildcard_mutex_);
+        wildcards_.match(topic, matched);
+    }
+
+    if (!exact && matched.empty()) {
+        unrouted_publishes_.fetch_add(1, std::memory_order_relaxed);
+        PUBSUB_LOG(trace) << "[topic_manager] Topic not found: " << topic;
+        return;
+    }
+
+    // Encode once per protocol in use, subscribers queue the same immutable
+    // frame: text, binary, and binary with compressed data
+    MessageView msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = topic;
+    std::array<Connection::FrameSPtr, 3> frames;
+    // Compressed on the first subscriber that takes it, reused between publishes on this thread
+    thread_local std::string deflated;
+    bool compress = !compressed.empty() || (compression_threshold_ != 0 && data.size() >= compression_threshold_);
+
+    const auto frame_for = [&](const std::shared_ptr<Connection> &connection) -> const Connection::FrameSPtr & {
+        const auto protocol = connection->protocol();
+        if (compress && compressed.empty() && protocol == ProtocolVersion::BINARY && connection->compression()) {
+            // Payloads that do not shrink are sent as they are
+            compress = compression::compress(data, deflated);
+            compressed = deflated;
+        }
+        const bool compressed_frame = compress && protocol == ProtocolVersion::BINARY && connection->compression();
+        auto &frame = frames[compressed_frame ? 2 : protocol == ProtocolVersion::BINARY ? 1 : 0];
+        if (!frame) {
+            // Only the binary protocol carries the log offset
+            msg.offset = protocol == ProtocolVersion::BINARY ? offset : kNoOffset;
+            msg.data = compressed_frame ? compressed : data;
+            msg.compressed = compressed_frame;
+            frame = make_frame(msg, protocol);
+        }
+        return frame;
+    };
+    const auto send = [&](const std::shared_ptr<Connection> &connection) {
+        PUBSUB_LOG(trace) << "[topic_manager] Publishing message to topic: " << topic;
+        // Only enqueues, a slow subscriber can not stall the others
+        connection->send(frame_for(connection), limits, slow_consumer_counters_);
+    };
+
+    if (exact) {
+        for (const auto &connection : exact->subscribers) {
+            send(connection);
+        }
+        // Replays past their handoff get this after the last records they read
+        for (const auto &[connection, replay] : exact->replays) {
+            if (replay->handoff != kNoOffset) {
+                hold(*replay, frame_for(connection));
+            }
+        }
+    }
+
+    if (!matched.empty()) {
+        // A connection matching through several subscriptions gets the message once
+        std::sort(matched.begin(), matched.end());
+        matched.erase(std::unique(matched.begin(), matched.end()), matched.end());
+        for (const auto &connection : matched) {
+            if (!exact || (!exact->subscribers.contains(connection) && !exact->replays.contains(connection))) {
+                send(connection);
             }
-        } else {
-            BOOST_LOG_TRIVIAL(warning) << "[topic_manager] Socket is closed, skipping message for topic: " << topic;
         }
+        matched.clear();
     }
 }
 
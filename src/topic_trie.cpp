@@ -0,0 +1,71 @@
+#include "topic_trie.h"
+
+namespace pubsub {
+
+void TopicTrie::match_node(const Node &node, topic::LevelIterator levels,
+                           std::vector<std::shared_ptr<Connection>> &subscribers) {
+    // '#' also matches when no levels are left
+    if (auto it = node.children.find(topic::kMultiLevelWildcard); it != node.children.end()) {
+        subscribers.insert(subscribers.end(), it->second->subscribers.begin(), it->second->subscribers.end());
+    }
+
+    std::string_view level;
+    if (!levels.next(level)) {
+        subscribers.insert(subscribers.end(), node.subscribers.begin(), node.subscribers.end());
+        return;
+    }
+
+    if (auto it = node.children.find(level); it != node.children.end()) {
+        match_node(*it->second, levels, subscribers);
+    }
+    if (auto it = node.children.find(topic::kSingleLevelWildcard); it != node.children.end()) {
+        match_node(*it->second, levels, subscribers);
+    }
+}
+
+// Remove the subscription below `node` and prune nodes left empty on the way back
+bool TopicTrie::erase_node(Node &node, topic::LevelIterator levels, const std::shared_ptr<Connection> &connection) {
+    std::string_view level;
+    if (!levels.next(level)) {
+        return node.subscribers.erase(connection) > 0;
+    }
+
+    auto it = node.children.find(level);
+    if (it == node.children.end()) {
+        return false;
+    }
+
+    const bool erased = erase_node(*it->second, levels, connection);
+    if (it->second->subscribers.empty() && it->second->children.empty()) {
+        node.children.erase(it);
+    }
+    return erased;
+}
+
+bool TopicTrie::insert(std::string_view filter, std::shared_ptr<Connection> connection) {
+    Node *node = &root_;
+    topic::LevelIterator levels(filter);
+    std::string_view level;
+    while (levels.next(level)) {
+        auto it = node->children.find(level);
+        if (it == node->children.end()) {
+            it = node->children.emplace(level, std::make_unique<Node>()).first;
+        }
+        node = it->second.get();
+    }
+    return node->subscribers.insert(std::move(connection)).second;
+}
+
+bool TopicTrie::erase(std::string_view filter, const std::shared_ptr<Connection> &connection) {
+    return erase_node(root_, topic::LevelIterator(filter), connection);
+}
+
+void TopicTrie::match(std::string_view topic, std::vector<std::shared_ptr<Connection>> &subscribers) const {
+    match_node(root_, topic::LevelIterator(topic), subscribers);
+}
+
+bool TopicTrie::empty() const {
+    return root_.children.empty() && root_.subscribers.empty();
+}
+
+}  // namespace pubsub
@@ -7,13 +7,23 @@
 
 class MockClient : public pubsub::client::PubSubClient {
 public:
-    MockClient(boost::asio::io_context &io_context)
-        : pubsub::client::PubSubClient(io_context) {}
+    MockClient(boost::asio::io_context &io_context,
+               pubsub::ProtocolVersion protocol = pubsub::ProtocolVersion::TEXT)
+        : pubsub::client::PubSubClient(io_context, protocol) {}
 
     MOCK_METHOD(void, on_message_received, (const std::string& topic, const std::string& message), (override));
+    MOCK_METHOD(void, on_stats_received, (const std::string& stats), (override));
 
-    void write(const pubsub::Message &message) override {
-        captured_messages_.push_back(message);
+    void write(const pubsub::MessageView &message) override {
+        pubsub::Message &captured = captured_messages_.emplace_back();
+        captured.type = message.type;
+        captured.topic = message.topic;
+        captured.data = message.data;
+        captured.version = message.version;
+        captured.alias = message.alias;
+        captured.offset = message.offset;
+        captured.capabilities = message.capabilities;
+        captured.compressed = message.compressed;
         pubsub::client::PubSubClient::write(message);
     }
 
@@ -12,7 +12,7 @@ public:
         : pubsub::server::PubSubServer(io_context, port) {}
 
     // Mock the handle_disconnect method
-    MOCK_METHOD(void, handle_disconnect, (std::shared_ptr<boost::asio::ip::tcp::socket> socket), (override));
+    MOCK_METHOD(void, handle_disconnect, (std::shared_ptr<pubsub::Connection> connection), (override));
 
     // Add method to retrieve received messages
     const std::vector<std::string>& get_received_messages() const {
@@ -23,9 +23,9 @@ private:
     std::vector<std::string> received_messages;
 
     // Override the process_message to store received messages
-    void process_message(std::shared_ptr<boost::asio::ip::tcp::socket> socket, const std::string &message) override {
-        received_messages.push_back(message);
-        pubsub::server::PubSubServer::process_message(socket, message);
+    void process_message(std::shared_ptr<pubsub::Connection> connection, std::string_view message) override {
+        received_messages.emplace_back(message);
+        pubsub::server::PubSubServer::process_message(connection, message);
     }
 };
 
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <boost/asio.hpp>
+#include <atomic>
 #include "message.h"
 #include "mock_client.h"
 #include "pubsub_server.h"
@@ -189,3 +190,215 @@ TEST_F(ClientTest, HandlesIncomingMessagesWithContentValidation) {
         client_thread.join();
     }
 }
+
+// Test that binary clients negotiate protocol version 2 and exchange binary safe payloads
+TEST_F(ClientTest, BinaryProtocolDeliversNewlines) {
+    boost::asio::io_context client_io_context;
+    MockClient subscriber(client_io_context, ProtocolVersion::BINARY);
+    MockClient publisher(client_io_context, ProtocolVersion::BINARY);
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    const std::string payload("multi\nline\npayload");
+
+    ASSERT_NO_THROW(subscriber.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(subscriber.connect("subscriber"));
+    ASSERT_NO_THROW(subscriber.subscribe("topic"));
+
+    EXPECT_CALL(subscriber, on_message_received(_, _))
+        .Times(1)
+        .WillOnce([&payload](const std::string &topic, const std::string &message) {
+            EXPECT_EQ(message, payload);
+            EXPECT_EQ(topic, "topic");
+        });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    ASSERT_NO_THROW(publisher.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(publisher.connect("publisher"));
+    ASSERT_NO_THROW(publisher.publish("topic", payload));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    subscriber.disconnect();
+    publisher.disconnect();
+    io_context.stop();
+    client_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+}
+
+TEST_F(ClientTest, BinaryPublishUsesTopicAlias) {
+    boost::asio::io_context client_io_context;
+    MockClient subscriber(client_io_context, ProtocolVersion::BINARY);
+    MockClient publisher(client_io_context, ProtocolVersion::BINARY);
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    ASSERT_NO_THROW(subscriber.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(subscriber.connect("subscriber"));
+    ASSERT_NO_THROW(subscriber.subscribe("topic"));
+
+    EXPECT_CALL(subscriber, on_message_received("topic", _)).Times(2);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    ASSERT_NO_THROW(publisher.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(publisher.connect("publisher"));
+    ASSERT_NO_THROW(publisher.publish("topic", "first"));
+    ASSERT_NO_THROW(publisher.publish("topic", "second"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // The first publish defines the alias, the second only carries the alias
+    const auto &messages = publisher.get_captured_messages();
+    ASSERT_EQ(messages.size(), 3u);
+    EXPECT_EQ(messages[1].alias, 0u);
+    EXPECT_EQ(messages[1].topic, "topic");
+    EXPECT_EQ(messages[2].alias, 0u);
+    EXPECT_TRUE(messages[2].topic.empty());
+
+    subscriber.disconnect();
+    publisher.disconnect();
+    io_context.stop();
+    client_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+}
+
+TEST_F(ClientTest, CompressedPayloadsReachEverySubscriberInflated) {
+    boost::asio::io_context client_io_context;
+    MockClient compressing(client_io_context, ProtocolVersion::BINARY);
+    MockClient plain(client_io_context, ProtocolVersion::BINARY);
+    MockClient publisher(client_io_context, ProtocolVersion::BINARY);
+    compressing.enable_compression();
+    publisher.enable_compression();
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    std::string payload;
+    while (payload.size() < 64 * 1024) {
+        payload += R"({"symbol":"AAPL","bid":187.25,"ask":187.27},)";
+    }
+
+    ASSERT_NO_THROW(compressing.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(compressing.connect("compressing"));
+    ASSERT_NO_THROW(compressing.subscribe("topic"));
+    ASSERT_NO_THROW(plain.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(plain.connect("plain"));
+    ASSERT_NO_THROW(plain.subscribe("topic"));
+
+    EXPECT_CALL(compressing, on_message_received("topic", payload)).Times(1);
+    EXPECT_CALL(plain, on_message_received("topic", payload)).Times(1);
+
+    ASSERT_NO_THROW(publisher.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(publisher.connect("publisher"));
+    // Publishes are only compressed once the CONNACK accepted it
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_NO_THROW(publisher.publish("topic", payload));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const auto &messages = publisher.get_captured_messages();
+    ASSERT_EQ(messages.size(), 2u);
+    EXPECT_EQ(messages[0].capabilities, Message::kCapabilityCompression);
+    EXPECT_TRUE(messages[1].compressed);
+    EXPECT_LT(messages[1].data.size(), payload.size());
+
+    compressing.disconnect();
+    plain.disconnect();
+    publisher.disconnect();
+    io_context.stop();
+    client_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+}
+
+TEST_F(ClientTest, BurstOfPublishesArrivesInOrder) {
+    boost::asio::io_context client_io_context;
+    MockClient subscriber(client_io_context);
+    MockClient publisher(client_io_context);
+    publisher.set_write_batching(std::chrono::milliseconds(1));
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    constexpr int kCount = 10000;
+    std::atomic<int> received{0};
+    EXPECT_CALL(subscriber, on_message_received("topic", _))
+        .WillRepeatedly([&received](const std::string &, const std::string &message) {
+            EXPECT_EQ(message, std::to_string(received.load()));
+            ++received;
+        });
+
+    ASSERT_NO_THROW(subscriber.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(subscriber.connect("subscriber"));
+    ASSERT_NO_THROW(subscriber.subscribe("topic"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    ASSERT_NO_THROW(publisher.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(publisher.connect("publisher"));
+    for (int i = 0; i < kCount; ++i) {
+        publisher.publish("topic", std::to_string(i));
+    }
+
+    for (int i = 0; i < 500 && received < kCount; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(received, kCount);
+
+    subscriber.disconnect();
+    publisher.disconnect();
+    io_context.stop();
+    client_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+}
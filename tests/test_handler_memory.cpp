@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include "handler_memory.h"
+
+using namespace pubsub;
+
+TEST(HandlerMemoryTest, ReusesBlockOnceReleased) {
+    HandlerMemory memory;
+    void *first = memory.allocate(64);
+    memory.deallocate(first);
+    void *second = memory.allocate(128);
+
+    EXPECT_EQ(first, second);
+    memory.deallocate(second);
+}
+
+TEST(HandlerMemoryTest, FallsBackToHeapWhenTakenOrTooLarge) {
+    HandlerMemory memory;
+    void *block = memory.allocate(64);
+    void *overflow = memory.allocate(64);
+    void *large = memory.allocate(HandlerMemory::kSize + 1);
+
+    EXPECT_NE(overflow, block);
+    EXPECT_NE(large, block);
+    memory.deallocate(overflow);
+    memory.deallocate(large);
+    memory.deallocate(block);
+
+    // Giving back heap blocks leaves the block taken until its own release
+    EXPECT_EQ(memory.allocate(64), block);
+    memory.deallocate(block);
+}
+
+TEST(HandlerMemoryTest, PostedOperationUsesBoundMemory) {
+    boost::asio::io_context io_context;
+    HandlerMemory memory;
+    void *block = memory.allocate(1);
+    memory.deallocate(block);
+
+    bool ran{false};
+    boost::asio::post(io_context.get_executor(), bind_memory(memory, [&ran]() { ran = true; }));
+
+    // The queued operation holds the block
+    void *other = memory.allocate(1);
+    EXPECT_NE(other, block);
+    memory.deallocate(other);
+
+    // and gives it back when it completes
+    io_context.run();
+    EXPECT_TRUE(ran);
+    void *again = memory.allocate(1);
+    EXPECT_EQ(again, block);
+    memory.deallocate(again);
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
+#include "compression.h"
+#include "frame_pool.h"
 #include "message.h"
+#include "topic.h"
 
 using namespace pubsub;
 
@@ -118,3 +121,351 @@ TEST(MessageTest, DeserializePublishWithExtraSpaces) {
     EXPECT_EQ(msg.topic, "my_topic");
     EXPECT_EQ(msg.data, "  Hello, World!  ");
 }
+
+TEST(MessageTest, SerializeConnectWithVersion) {
+    Message msg;
+    msg.type = MessageType::CONNECT;
+    msg.data = "client1";
+    msg.version = ProtocolVersion::BINARY;
+    EXPECT_EQ(msg.serialize(), "CONNECT client1 2\n");
+}
+
+TEST(MessageTest, DeserializeConnectWithVersion) {
+    Message msg = Message::deserialize("CONNECT client1 2");
+    EXPECT_EQ(msg.type, MessageType::CONNECT);
+    EXPECT_EQ(msg.data, "client1");
+    EXPECT_EQ(msg.version, ProtocolVersion::BINARY);
+}
+
+TEST(MessageTest, DeserializeConnack) {
+    Message msg = Message::deserialize("CONNACK 2");
+    EXPECT_EQ(msg.type, MessageType::CONNACK);
+    EXPECT_EQ(msg.version, ProtocolVersion::BINARY);
+}
+
+TEST(MessageTest, BinaryRoundTripKeepsNewlines) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    msg.data = std::string("line1\nline2\0end", 15);
+
+    const std::string frame = msg.serialize(ProtocolVersion::BINARY);
+    EXPECT_EQ(frame.size(), Message::kBinaryHeaderSize + msg.topic.size() + msg.data.size());
+
+    Message decoded = Message::deserialize(frame, ProtocolVersion::BINARY);
+    EXPECT_EQ(decoded.type, MessageType::PUBLISH);
+    EXPECT_EQ(decoded.topic, msg.topic);
+    EXPECT_EQ(decoded.data, msg.data);
+}
+
+TEST(MessageTest, DeserializeBinaryTruncated) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    msg.data = "data";
+
+    const std::string frame = msg.serialize(ProtocolVersion::BINARY);
+    EXPECT_EQ(Message::deserialize(frame.substr(0, frame.size() - 1), ProtocolVersion::BINARY).type,
+              MessageType::UNKNOWN);
+}
+
+TEST(MessageTest, BinaryTopicAliasDefinition) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    msg.data = "data";
+    msg.alias = 7;
+
+    const std::string frame = msg.serialize(ProtocolVersion::BINARY);
+    EXPECT_EQ(frame[1], static_cast<char>(Message::kFlagTopicAlias));
+
+    Message decoded = Message::deserialize(frame, ProtocolVersion::BINARY);
+    EXPECT_EQ(decoded.type, MessageType::PUBLISH);
+    EXPECT_EQ(decoded.alias, 7u);
+    EXPECT_EQ(decoded.topic, "my_topic");
+    EXPECT_EQ(decoded.data, "data");
+}
+
+TEST(MessageTest, BinaryTopicAliasOnly) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.data = "data";
+    msg.alias = 7;
+
+    const std::string frame = msg.serialize(ProtocolVersion::BINARY);
+    EXPECT_EQ(frame.size(), Message::kBinaryHeaderSize + 4 + msg.data.size());
+
+    Message decoded = Message::deserialize(frame, ProtocolVersion::BINARY);
+    EXPECT_EQ(decoded.type, MessageType::PUBLISH);
+    EXPECT_EQ(decoded.alias, 7u);
+    EXPECT_TRUE(decoded.topic.empty());
+
+    // Without an alias the topic is still required
+    msg.alias = kNoTopicAlias;
+    EXPECT_EQ(Message::deserialize(msg.serialize(ProtocolVersion::BINARY), ProtocolVersion::BINARY).type,
+              MessageType::UNKNOWN);
+}
+
+TEST(MessageTest, BinaryTopicAliasOutOfRange) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.data = "data";
+    msg.alias = Message::kMaxTopicAlias + 1;
+
+    EXPECT_EQ(Message::deserialize(msg.serialize(ProtocolVersion::BINARY), ProtocolVersion::BINARY).type,
+              MessageType::UNKNOWN);
+}
+
+TEST(MessageTest, SubscribeWithOffset) {
+    Message msg;
+    msg.type = MessageType::SUBSCRIBE;
+    msg.topic = "my_topic";
+    msg.offset = 42;
+    EXPECT_EQ(msg.serialize(), "SUBSCRIBE my_topic 42\n");
+
+    Message decoded = Message::deserialize("SUBSCRIBE my_topic 42");
+    EXPECT_EQ(decoded.type, MessageType::SUBSCRIBE);
+    EXPECT_EQ(decoded.topic, "my_topic");
+    EXPECT_EQ(decoded.offset, 42u);
+
+    EXPECT_EQ(Message::deserialize("SUBSCRIBE my_topic").offset, kNoOffset);
+    EXPECT_EQ(Message::deserialize("SUBSCRIBE my_topic latest").type, MessageType::UNKNOWN);
+
+    decoded = Message::deserialize(msg.serialize(ProtocolVersion::BINARY), ProtocolVersion::BINARY);
+    EXPECT_EQ(decoded.type, MessageType::SUBSCRIBE);
+    EXPECT_EQ(decoded.topic, "my_topic");
+    EXPECT_EQ(decoded.offset, 42u);
+}
+
+TEST(MessageTest, BinaryPublishWithAliasAndOffset) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    msg.data = "data";
+    msg.alias = 3;
+    msg.offset = 0x0102030405060708;
+
+    const std::string frame = msg.serialize(ProtocolVersion::BINARY);
+    EXPECT_EQ(frame[1], static_cast<char>(Message::kFlagTopicAlias | Message::kFlagOffset));
+
+    Message decoded = Message::deserialize(frame, ProtocolVersion::BINARY);
+    EXPECT_EQ(decoded.type, MessageType::PUBLISH);
+    EXPECT_EQ(decoded.alias, 3u);
+    EXPECT_EQ(decoded.offset, msg.offset);
+    EXPECT_EQ(decoded.topic, "my_topic");
+    EXPECT_EQ(decoded.data, "data");
+}
+
+TEST(MessageTest, Stats) {
+    Message msg;
+    msg.type = MessageType::STATS;
+    EXPECT_EQ(msg.serialize(), "STATS\n");
+    EXPECT_EQ(Message::deserialize("STATS").type, MessageType::STATS);
+
+    msg.data = "frames_in=1 bytes_in=2";
+    EXPECT_EQ(msg.serialize(), "STATS frames_in=1 bytes_in=2\n");
+    EXPECT_EQ(Message::deserialize("STATS frames_in=1 bytes_in=2").data, msg.data);
+
+    Message decoded = Message::deserialize(msg.serialize(ProtocolVersion::BINARY), ProtocolVersion::BINARY);
+    EXPECT_EQ(decoded.type, MessageType::STATS);
+    EXPECT_EQ(decoded.data, msg.data);
+}
+
+TEST(MessageTest, Shm) {
+    Message msg;
+    msg.type = MessageType::SHM;
+    msg.data = "/pubsub-42-0";
+    EXPECT_EQ(msg.serialize(), "SHM /pubsub-42-0\n");
+
+    Message decoded = Message::deserialize("SHM /pubsub-42-0");
+    EXPECT_EQ(decoded.type, MessageType::SHM);
+    EXPECT_EQ(decoded.data, msg.data);
+}
+
+TEST(MessageTest, NextFrameText) {
+    std::string_view frame;
+    EXPECT_EQ(Message::next_frame("SUBSCRIBE a", ProtocolVersion::TEXT, frame), 0);
+    EXPECT_EQ(Message::next_frame("SUBSCRIBE a\nSUBSCRIBE b", ProtocolVersion::TEXT, frame), 12);
+    EXPECT_EQ(frame, "SUBSCRIBE a");
+}
+
+TEST(MessageTest, NextFrameBinary) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    msg.data = "a\nb";
+    const std::string frame = msg.serialize(ProtocolVersion::BINARY);
+    const std::string buffer = frame + frame;
+
+    std::string_view next;
+    EXPECT_EQ(Message::next_frame(std::string_view(buffer).substr(0, frame.size() - 1), ProtocolVersion::BINARY, next),
+              0);
+    EXPECT_EQ(Message::next_frame(buffer, ProtocolVersion::BINARY, next), frame.size());
+    EXPECT_EQ(next, frame);
+}
+
+TEST(MessageTest, NextFrameRejectsOversizedFrames) {
+    // The header alone tells, nothing of the data has to be buffered
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    std::string header = msg.serialize(ProtocolVersion::BINARY).substr(0, Message::kBinaryHeaderSize);
+    std::fill(header.begin() + 4, header.end(), '\xFF');
+
+    std::string_view next;
+    EXPECT_EQ(Message::next_frame(header, ProtocolVersion::BINARY, next), Message::kFrameTooLarge);
+}
+
+TEST(MessageTest, ParseReturnsViewsIntoFrame) {
+    const std::string frame = "PUBLISH my_topic Hello, World!";
+    MessageView view = MessageView::parse(frame);
+    EXPECT_EQ(view.type, MessageType::PUBLISH);
+    EXPECT_EQ(view.topic, "my_topic");
+    EXPECT_EQ(view.data, "Hello, World!");
+    EXPECT_EQ(view.topic.data(), frame.data() + 8);
+    EXPECT_EQ(view.data.data(), frame.data() + 17);
+}
+
+TEST(MessageTest, ParseCommandPrefixIsUnknown) {
+    EXPECT_EQ(MessageView::parse("PUBLISHX my_topic data").type, MessageType::UNKNOWN);
+    EXPECT_EQ(MessageView::parse("SUBSCRIB my_topic").type, MessageType::UNKNOWN);
+    EXPECT_EQ(MessageView::parse("\tSUBSCRIBE\tmy_topic").type, MessageType::SUBSCRIBE);
+}
+
+TEST(MessageTest, DeserializeWildcardSubscribe) {
+    EXPECT_EQ(Message::deserialize("SUBSCRIBE md.equities.*").type, MessageType::SUBSCRIBE);
+    EXPECT_EQ(Message::deserialize("SUBSCRIBE md.#").type, MessageType::SUBSCRIBE);
+    EXPECT_EQ(Message::deserialize("UNSUBSCRIBE *.equities.#").type, MessageType::UNSUBSCRIBE);
+}
+
+TEST(MessageTest, DeserializeMultiLevelWildcardNotLast) {
+    EXPECT_EQ(Message::deserialize("SUBSCRIBE md.#.aapl").type, MessageType::UNKNOWN);
+}
+
+TEST(MessageTest, DeserializePublishToWildcard) {
+    EXPECT_EQ(Message::deserialize("PUBLISH md.* data").type, MessageType::UNKNOWN);
+    EXPECT_EQ(Message::deserialize("PUBLISH md.# data").type, MessageType::UNKNOWN);
+    // Wildcard characters are only special as a whole level
+    EXPECT_EQ(Message::deserialize("PUBLISH md.a*b data").type, MessageType::PUBLISH);
+}
+
+TEST(MessageTest, TopicFilterMatches) {
+    EXPECT_TRUE(topic::matches("md.equities.*", "md.equities.aapl"));
+    EXPECT_FALSE(topic::matches("md.equities.*", "md.equities.aapl.bid"));
+    EXPECT_FALSE(topic::matches("md.equities.*", "md.equities"));
+    EXPECT_TRUE(topic::matches("md.#", "md"));
+    EXPECT_TRUE(topic::matches("md.#", "md.equities.aapl.bid"));
+    EXPECT_FALSE(topic::matches("md.#", "ref.fx"));
+    EXPECT_TRUE(topic::matches("md.aapl", "md.aapl"));
+    EXPECT_FALSE(topic::matches("md.aapl", "md.aapl.bid"));
+}
+
+TEST(MessageTest, SerializeToAppends) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    msg.data = "Hello";
+
+    std::string out{"SUBSCRIBE other\n"};
+    msg.view().serialize_to(out, ProtocolVersion::TEXT);
+    EXPECT_EQ(out, "SUBSCRIBE other\n" + msg.serialize(ProtocolVersion::TEXT));
+}
+
+TEST(MessageTest, MakeFrameMatchesSerialize) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    msg.data = "Hello, World!";
+
+    for (const auto protocol : {ProtocolVersion::TEXT, ProtocolVersion::BINARY}) {
+        const auto frame = make_frame(msg.view(), protocol);
+        EXPECT_EQ(std::string_view(*frame), msg.serialize(protocol));
+    }
+}
+
+TEST(MessageTest, ConnectCarriesCapabilities) {
+    Message connect;
+    connect.type = MessageType::CONNECT;
+    connect.data = "client";
+    connect.version = ProtocolVersion::BINARY;
+    connect.capabilities = Message::kCapabilityCompression;
+    EXPECT_EQ(connect.serialize(), "CONNECT client 2 compress\n");
+
+    const auto parsed = Message::deserialize("CONNECT client 2 compress");
+    EXPECT_EQ(parsed.capabilities, Message::kCapabilityCompression);
+    // Capabilities this side does not know are ignored
+    EXPECT_EQ(Message::deserialize("CONNECT client 2 future compress").capabilities, Message::kCapabilityCompression);
+    EXPECT_EQ(Message::deserialize("CONNECT client 2").capabilities, 0);
+
+    const auto ack = Message::deserialize("CONNACK 2 compress");
+    EXPECT_EQ(ack.type, MessageType::CONNACK);
+    EXPECT_EQ(ack.capabilities, Message::kCapabilityCompression);
+}
+
+TEST(MessageTest, BinaryCompressedFlag) {
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = "my_topic";
+    msg.data = "compressed bytes";
+    msg.compressed = true;
+
+    const auto frame = msg.serialize(ProtocolVersion::BINARY);
+    EXPECT_EQ(static_cast<std::uint8_t>(frame[1]), Message::kFlagCompressed);
+    const auto parsed = Message::deserialize(frame, ProtocolVersion::BINARY);
+    EXPECT_TRUE(parsed.compressed);
+    EXPECT_EQ(parsed.data, "compressed bytes");
+}
+
+TEST(MessageTest, CompressionRoundTrip) {
+    std::string payload;
+    for (int i = 0; i < 1000; ++i) {
+        payload += R"({"symbol":"AAPL","bid":187.25,"ask":187.27},)";
+    }
+
+    std::string compressed;
+    ASSERT_TRUE(compression::compress(payload, compressed));
+    EXPECT_LT(compressed.size(), payload.size() / 10);
+    std::string inflated;
+    ASSERT_TRUE(compression::decompress(compressed, inflated));
+    EXPECT_EQ(inflated, payload);
+
+    // Truncated or claiming another size
+    EXPECT_FALSE(compression::decompress(std::string_view(compressed).substr(0, compressed.size() / 2), inflated));
+    compressed[3] = static_cast<char>(compressed[3] + 1);
+    EXPECT_FALSE(compression::decompress(compressed, inflated));
+
+    // A few bytes can not inflate to the largest size allowed
+    std::string bomb("\x10\x00\x00\x00", 4);
+    bomb += compressed.substr(4, 16);
+    EXPECT_FALSE(compression::decompress(bomb, inflated));
+    EXPECT_LT(inflated.capacity(), compression::kMaxInflatedBytes);
+
+    // Nothing gained on tiny payloads
+    EXPECT_FALSE(compression::compress("abc", compressed));
+    EXPECT_TRUE(compressed.empty());
+}
+
+TEST(MessageTest, RejectsTopicsTooLongForBinaryFrames) {
+    const std::string longest(Message::kMaxTopicSize, 't');
+    const std::string too_long(Message::kMaxTopicSize + 1, 't');
+    EXPECT_EQ(Message::deserialize("PUBLISH " + longest + " data").type, MessageType::PUBLISH);
+    EXPECT_EQ(Message::deserialize("PUBLISH " + too_long + " data").type, MessageType::UNKNOWN);
+    EXPECT_EQ(Message::deserialize("SUBSCRIBE " + std::string(70000, 't')).type, MessageType::UNKNOWN);
+
+    // Binary frames can carry a longer name in their 16 bit field, it still has to fit once forwarded
+    Message msg;
+    msg.type = MessageType::PUBLISH;
+    msg.topic = too_long;
+    msg.data = "data";
+    EXPECT_EQ(Message::deserialize(msg.serialize(ProtocolVersion::BINARY), ProtocolVersion::BINARY).type,
+              MessageType::UNKNOWN);
+
+    // The longest name with an alias and an offset still frames correctly
+    msg.topic = longest;
+    msg.alias = 1;
+    msg.offset = 7;
+    const auto frame = msg.serialize(ProtocolVersion::BINARY);
+    std::string_view next;
+    EXPECT_EQ(Message::next_frame(frame, ProtocolVersion::BINARY, next), frame.size());
+    EXPECT_EQ(std::string_view(Message::deserialize(frame, ProtocolVersion::BINARY).topic), longest);
+}
@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "message_log.h"
+
+using namespace pubsub;
+
+class MessageLogTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        directory = std::filesystem::temp_directory_path() /
+                    ("pubsub_log_" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+        std::filesystem::remove_all(directory);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(directory);
+    }
+
+    MessageLog::Options options() const {
+        MessageLog::Options options;
+        options.directory = directory;
+        return options;
+    }
+
+    // Wait for the writer thread to get every record before `offset` into the files
+    static bool wait_written(TopicLog &log, std::uint64_t offset) {
+        auto written = std::make_shared<std::promise<void>>();
+        auto future = written->get_future();
+        log.when_written(offset, [written]() { written->set_value(); });
+        return future.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+    }
+
+    static std::vector<std::pair<std::uint64_t, std::string>> read_all(TopicLog &log, std::uint64_t from = 0) {
+        std::vector<std::pair<std::uint64_t, std::string>> records;
+        const auto end = log.next_offset();
+        EXPECT_TRUE(wait_written(log, end));
+        log.read(from, end, [&records](std::uint64_t offset, std::string_view data) {
+            records.emplace_back(offset, std::string(data));
+        });
+        return records;
+    }
+
+    std::filesystem::path directory;
+};
+
+TEST_F(MessageLogTest, AppendAssignsSequentialOffsets) {
+    MessageLog message_log(options());
+    auto log = message_log.open("topic");
+    ASSERT_TRUE(log);
+
+    EXPECT_EQ(log->append("a"), 0u);
+    EXPECT_EQ(log->append(std::string("b\0c", 3)), 1u);
+    EXPECT_EQ(log->append(""), 2u);
+
+    const auto records = read_all(*log);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0], std::make_pair(std::uint64_t{0}, std::string("a")));
+    EXPECT_EQ(records[1], std::make_pair(std::uint64_t{1}, std::string("b\0c", 3)));
+    EXPECT_EQ(records[2], std::make_pair(std::uint64_t{2}, std::string()));
+}
+
+TEST_F(MessageLogTest, ReadFromOffsetAcrossSegments) {
+    auto opts = options();
+    opts.segment_bytes = 64;
+    MessageLog message_log(opts);
+    auto log = message_log.open("topic");
+
+    for (int i = 0; i < 50; ++i) {
+        log->append("message " + std::to_string(i));
+        // Separate batches so segments get rolled in between
+        ASSERT_TRUE(wait_written(*log, i + 1));
+    }
+
+    EXPECT_GT(std::distance(std::filesystem::directory_iterator(directory / "topic"),
+                            std::filesystem::directory_iterator()),
+              1);
+
+    const auto records = read_all(*log, 42);
+    ASSERT_EQ(records.size(), 8u);
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        EXPECT_EQ(records[i].first, 42 + i);
+        EXPECT_EQ(records[i].second, "message " + std::to_string(42 + i));
+    }
+}
+
+TEST_F(MessageLogTest, CursorContinuesWhereItStopped) {
+    auto opts = options();
+    opts.segment_bytes = 64;
+    MessageLog message_log(opts);
+    auto log = message_log.open("topic");
+
+    LogCursor cursor(*log, 0);
+    std::vector<std::uint64_t> offsets;
+    // Stops before every third record, which the next read starts with
+    const auto read = [&](std::uint64_t to) {
+        std::size_t count{0};
+        cursor.read(to, [&](std::uint64_t offset, std::string_view data) {
+            if (++count == 3) {
+                return false;
+            }
+            EXPECT_EQ(data, "message " + std::to_string(offset));
+            offsets.push_back(offset);
+            return true;
+        });
+    };
+
+    for (int i = 0; i < 20; ++i) {
+        log->append("message " + std::to_string(i));
+        ASSERT_TRUE(wait_written(*log, i + 1));
+        read(20);
+    }
+    while (cursor.position() < 20) {
+        read(20);
+    }
+
+    ASSERT_EQ(offsets.size(), 20u);
+    for (std::size_t i = 0; i < offsets.size(); ++i) {
+        EXPECT_EQ(offsets[i], i);
+    }
+}
+
+TEST_F(MessageLogTest, WhenWrittenRunsOnceWritten) {
+    MessageLog message_log(options());
+    auto log = message_log.open("topic");
+
+    bool ran{false};
+    log->when_written(0, [&ran]() { ran = true; });
+    EXPECT_TRUE(ran);
+
+    auto written = std::make_shared<std::promise<void>>();
+    auto future = written->get_future();
+    log->when_written(2, [written]() { written->set_value(); });
+    log->append("a");
+    log->append("b");
+    EXPECT_EQ(future.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+}
+
+TEST_F(MessageLogTest, RecoversAfterRestart) {
+    {
+        MessageLog message_log(options());
+        auto log = message_log.open("sensors.temp");
+        log->append("first");
+        log->append("second");
+    }
+
+    MessageLog message_log(options());
+    auto log = message_log.open("sensors.temp");
+    EXPECT_EQ(log->next_offset(), 2u);
+    EXPECT_EQ(log->append("third"), 2u);
+
+    const auto records = read_all(*log);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].second, "first");
+    EXPECT_EQ(records[2].second, "third");
+}
+
+TEST_F(MessageLogTest, DropsTornRecordOnRecovery) {
+    {
+        MessageLog message_log(options());
+        message_log.open("topic")->append("complete");
+    }
+
+    // A crash in the middle of a write leaves a partial record behind
+    const auto segment = std::filesystem::directory_iterator(directory / "topic")->path();
+    {
+        std::ofstream out(segment, std::ios::binary | std::ios::app);
+        out.write("\0\0\0\0\0\0\0\1\0\0\0\x10part", 16);
+    }
+
+    MessageLog message_log(options());
+    auto log = message_log.open("topic");
+    EXPECT_EQ(log->next_offset(), 1u);
+    EXPECT_EQ(log->append("next"), 1u);
+
+    const auto records = read_all(*log);
+    ASSERT_EQ(records.size(), 2u);
+    EXPECT_EQ(records[1].second, "next");
+}
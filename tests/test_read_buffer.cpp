@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include "read_buffer.h"
+
+using namespace pubsub;
+
+namespace {
+
+// Copy `bytes` into the buffer as a socket read would
+void receive(ReadBuffer &buffer, const std::string &bytes) {
+    auto space = buffer.prepare();
+    ASSERT_GE(space.size(), bytes.size());
+    std::memcpy(space.data(), bytes.data(), bytes.size());
+    buffer.commit(bytes.size());
+}
+
+}  // namespace
+
+TEST(ReadBufferTest, StartsEmpty) {
+    ReadBuffer buffer;
+    EXPECT_TRUE(buffer.data().empty());
+    EXPECT_EQ(buffer.read_size(), ReadBuffer::kMinReadSize);
+}
+
+TEST(ReadBufferTest, ConsumeAdvancesWithoutCopying) {
+    ReadBuffer buffer;
+    receive(buffer, "first\nsecond\nthi");
+
+    const char *second = buffer.data().data() + 6;
+    buffer.consume(6);
+    EXPECT_EQ(buffer.data(), "second\nthi");
+    EXPECT_EQ(buffer.data().data(), second);
+
+    buffer.consume(7);
+    receive(buffer, "rd\n");
+    EXPECT_EQ(buffer.data(), "third\n");
+}
+
+TEST(ReadBufferTest, KeepsPartialFrameAcrossCompaction) {
+    ReadBuffer buffer;
+    const std::string filler(ReadBuffer::kMinReadSize / 2, 'x');
+    receive(buffer, filler);
+    receive(buffer, "partial");
+    buffer.consume(filler.size());
+
+    // The unread tail moves to the front instead of the buffer growing
+    const std::size_t capacity = buffer.capacity();
+    receive(buffer, " frame");
+    EXPECT_EQ(buffer.data(), "partial frame");
+    EXPECT_EQ(buffer.capacity(), capacity);
+}
+
+TEST(ReadBufferTest, ReadSizeAdaptsToTraffic) {
+    ReadBuffer buffer;
+    // Full reads double the read size up to the limit
+    while (buffer.read_size() < ReadBuffer::kMaxReadSize) {
+        const std::size_t before = buffer.read_size();
+        receive(buffer, std::string(before, 'x'));
+        buffer.consume(before);
+        EXPECT_EQ(buffer.read_size(), before * 2);
+    }
+
+    // Mostly empty reads shrink it back
+    while (buffer.read_size() > ReadBuffer::kMinReadSize) {
+        receive(buffer, "x");
+        buffer.consume(1);
+    }
+    EXPECT_EQ(buffer.read_size(), ReadBuffer::kMinReadSize);
+}
+
+TEST(ReadBufferTest, GrowsForLargeFrames) {
+    ReadBuffer buffer;
+    std::string frame;
+    while (frame.size() < 5 * ReadBuffer::kMaxReadSize) {
+        const std::string chunk(buffer.read_size(), 'x');
+        receive(buffer, chunk);
+        frame += chunk;
+    }
+    EXPECT_EQ(buffer.data(), frame);
+
+    // Released again once the frame is consumed
+    buffer.consume(frame.size());
+    EXPECT_EQ(buffer.capacity(), 0u);
+}
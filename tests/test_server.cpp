@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 #include <boost/asio.hpp>
+#include <unistd.h>
+#include <algorithm>
 #include "message.h"
+#include "metrics_server.h"
 #include "mock_client.h"
 #include "mock_server.h"
 
@@ -192,3 +195,486 @@ TEST_F(ServerTest, NoCrashWhenClientDisconnectsAndOtherClientPublishes) {
         client1_thread.join();  // Wait for client1 thread to finish
     }
 }
+
+TEST_F(ServerTest, SlowSubscriberDoesNotStallOthers) {
+    boost::asio::io_context client1_io_context;
+    boost::asio::io_context client2_io_context;
+    boost::asio::io_context slow_io_context;
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    MockClient client1(client1_io_context);
+    pubsub::client::PubSubClient client2(client2_io_context);
+
+    std::thread client1_thread([&client1_io_context]() {
+        boost::asio::io_context::work work(client1_io_context);
+        client1_io_context.run();
+    });
+
+    std::thread client2_thread([&client2_io_context]() {
+        boost::asio::io_context::work work(client2_io_context);
+        client2_io_context.run();
+    });
+
+    // A subscriber that never reads, its socket buffers fill up quickly
+    boost::asio::ip::tcp::socket slow_socket(slow_io_context);
+    slow_socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 12345));
+    boost::asio::write(slow_socket, boost::asio::buffer(std::string("SUBSCRIBE topic\n")));
+
+    ASSERT_NO_THROW(client1.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(client1.connect("client1"));
+    ASSERT_NO_THROW(client1.subscribe("topic"));
+
+    constexpr int kMessages = 100;
+    std::atomic<int> received{0};
+    EXPECT_CALL(client1, on_message_received(_, _))
+        .Times(kMessages)
+        .WillRepeatedly([&received](const std::string &, const std::string &) {
+            received++;
+        });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    ASSERT_NO_THROW(client2.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(client2.connect("client2"));
+
+    // Far more than the slow subscriber's socket buffers can hold
+    const std::string payload(64 * 1024, 'x');
+    for (int i = 0; i < kMessages; ++i) {
+        ASSERT_NO_THROW(client2.publish("topic", payload));
+    }
+
+    for (int i = 0; i < 200 && received < kMessages; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(received, kMessages);
+
+    slow_socket.close();
+    client1.disconnect();
+    client2.disconnect();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    io_context.stop();
+    client1_io_context.stop();
+    client2_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client1_thread.joinable()) {
+        client1_thread.join();
+    }
+    if (client2_thread.joinable()) {
+        client2_thread.join();
+    }
+}
+
+TEST_F(ServerTest, StatsReportsCounters) {
+    boost::asio::io_context client_io_context;
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    MockClient client(client_io_context);
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    ASSERT_NO_THROW(client.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(client.connect("client"));
+    ASSERT_NO_THROW(client.subscribe("topic"));
+    ASSERT_NO_THROW(client.publish("topic", "data"));
+    ASSERT_NO_THROW(client.publish("nobody", "data"));
+
+    EXPECT_CALL(client, on_message_received("topic", "data")).Times(1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::string stats;
+    EXPECT_CALL(client, on_stats_received(_)).Times(1).WillOnce([&stats](const std::string &received) {
+        stats = received;
+    });
+    ASSERT_NO_THROW(client.stats());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // CONNECT, SUBSCRIBE, two PUBLISH and the STATS request itself
+    EXPECT_NE(stats.find("frames_in=5 "), std::string::npos) << stats;
+    EXPECT_NE(stats.find("frames_out=1 "), std::string::npos) << stats;
+    EXPECT_NE(stats.find("connections=1 "), std::string::npos) << stats;
+    EXPECT_NE(stats.find("topics=1 subscriptions=1 unrouted_publishes=1 "), std::string::npos) << stats;
+    EXPECT_NE(stats.find(" queue=127.0.0.1:"), std::string::npos) << stats;
+
+    client.disconnect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    io_context.stop();
+    client_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+}
+
+TEST_F(ServerTest, ClosesConnectionOnOversizedFrame) {
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    EXPECT_CALL(*mock_server, handle_disconnect(_)).Times(1);
+
+    boost::asio::io_context client_io_context;
+    boost::asio::ip::tcp::socket socket(client_io_context);
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 12345));
+
+    pubsub::Message connect;
+    connect.type = pubsub::MessageType::CONNECT;
+    connect.data = "raw";
+    connect.version = pubsub::ProtocolVersion::BINARY;
+    // A binary header declaring 4 GiB of data, nothing of it follows
+    pubsub::Message publish;
+    publish.type = pubsub::MessageType::PUBLISH;
+    publish.topic = "t";
+    std::string header = publish.serialize(pubsub::ProtocolVersion::BINARY);
+    std::fill(header.begin() + 4, header.begin() + 8, '\xFF');
+    boost::asio::write(socket, boost::asio::buffer(connect.serialize() + header));
+
+    // Closed without waiting for the data, the CONNACK may be dropped with it
+    std::string received;
+    boost::system::error_code ec;
+    boost::asio::async_read(socket, boost::asio::dynamic_buffer(received),
+                            [&ec](const boost::system::error_code &error, std::size_t) { ec = error; });
+    client_io_context.run_for(std::chrono::seconds(5));
+    EXPECT_TRUE(ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset) << ec.message();
+
+    io_context.stop();
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+}
+
+TEST_F(ServerTest, UnixSocketClientsShareRoutingWithTcpClients) {
+    const std::string path = "/tmp/pubsub_test_" + std::to_string(::getpid()) + ".sock";
+    ASSERT_TRUE(mock_server->listen_local(path));
+
+    boost::asio::io_context client_io_context;
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    MockClient local(client_io_context, pubsub::ProtocolVersion::BINARY);
+    MockClient remote(client_io_context);
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    ASSERT_NO_THROW(local.connect_local(path));
+    ASSERT_NO_THROW(local.connect("local"));
+    ASSERT_NO_THROW(local.subscribe("local.topic"));
+    ASSERT_NO_THROW(remote.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(remote.connect("remote"));
+    ASSERT_NO_THROW(remote.subscribe("remote.topic"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    EXPECT_CALL(local, on_message_received("local.topic", "from tcp")).Times(1);
+    EXPECT_CALL(remote, on_message_received("remote.topic", "from unix")).Times(1);
+    ASSERT_NO_THROW(remote.publish("local.topic", "from tcp"));
+    ASSERT_NO_THROW(local.publish("remote.topic", "from unix"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::string stats;
+    EXPECT_CALL(local, on_stats_received(_)).Times(1).WillOnce([&stats](const std::string &received) {
+        stats = received;
+    });
+    ASSERT_NO_THROW(local.stats());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    EXPECT_NE(stats.find(" queue=unix:" + path + ","), std::string::npos) << stats;
+
+    local.disconnect();
+    remote.disconnect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    io_context.stop();
+    client_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+}
+
+TEST_F(ServerTest, SharedMemoryClientsShareRoutingWithTcpClients) {
+    const std::string path = "/tmp/pubsub_test_" + std::to_string(::getpid()) + ".sock";
+    ASSERT_TRUE(mock_server->listen_local(path));
+
+    boost::asio::io_context client_io_context;
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    MockClient local(client_io_context, pubsub::ProtocolVersion::BINARY);
+    MockClient remote(client_io_context);
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    ASSERT_NO_THROW(local.connect_shared_memory(path));
+    ASSERT_NO_THROW(local.connect("local"));
+    ASSERT_NO_THROW(local.subscribe("local.topic"));
+    ASSERT_NO_THROW(remote.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(remote.connect("remote"));
+    ASSERT_NO_THROW(remote.subscribe("remote.topic"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // Larger than the ring, so both sides have to wait for room
+    const std::string large(3 * pubsub::ShmChannel::kDefaultRingBytes / 2, 'x');
+    EXPECT_CALL(local, on_message_received("local.topic", "from tcp")).Times(1);
+    EXPECT_CALL(local, on_message_received("local.topic", large)).Times(1);
+    EXPECT_CALL(remote, on_message_received("remote.topic", "from shm")).Times(1);
+    EXPECT_CALL(remote, on_message_received("remote.topic", large)).Times(1);
+    ASSERT_NO_THROW(remote.publish("local.topic", "from tcp"));
+    ASSERT_NO_THROW(remote.publish("local.topic", large));
+    ASSERT_NO_THROW(local.publish("remote.topic", "from shm"));
+    ASSERT_NO_THROW(local.publish("remote.topic", large));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    EXPECT_CALL(*mock_server, handle_disconnect(_)).Times(2);
+    local.disconnect();
+    remote.disconnect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // The SHM frame, and then everything the clients sent
+    const auto &received = mock_server->get_received_messages();
+    EXPECT_EQ(std::count_if(received.begin(), received.end(),
+                            [](const std::string &frame) { return frame.rfind("SHM ", 0) == 0; }),
+              1);
+    EXPECT_EQ(received.size(), 11u);
+
+    io_context.stop();
+    client_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+}
+
+TEST_F(ServerTest, MetricsEndpointServesPrometheusText) {
+    // Busiest topics refreshed well within the waits below
+    pubsub::server::MetricsServer metrics(io_context, 12347, mock_server->stats(), mock_server->topic_manager(),
+                                          pubsub::server::MetricsServer::kDefaultTopTopics,
+                                          std::chrono::milliseconds(10));
+    boost::asio::io_context client_io_context;
+
+    std::thread server_thread([this]() {
+        io_context.run();
+    });
+
+    MockClient client(client_io_context);
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    EXPECT_CALL(client, on_message_received("md.aapl", "data")).Times(2);
+
+    ASSERT_NO_THROW(client.connect_socket("127.0.0.1", "12345"));
+    ASSERT_NO_THROW(client.connect("client"));
+    ASSERT_NO_THROW(client.subscribe("md.aapl"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_NO_THROW(client.publish("md.aapl", "data"));
+    ASSERT_NO_THROW(client.publish("md.aapl", "data"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    const auto scrape = [](const std::string &target) {
+        boost::asio::io_context scrape_context;
+        boost::asio::ip::tcp::socket socket(scrape_context);
+        socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 12347));
+        boost::asio::write(socket, boost::asio::buffer("GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+        std::string response;
+        boost::system::error_code ec;
+        boost::asio::read(socket, boost::asio::dynamic_buffer(response), ec);
+        return response;
+    };
+
+    const std::string response = scrape("/metrics");
+    EXPECT_EQ(response.rfind("HTTP/1.1 200 OK\r\n", 0), 0u) << response;
+    EXPECT_NE(response.find("\npubsub_frames_received_total 4\n"), std::string::npos) << response;
+    EXPECT_NE(response.find("\npubsub_subscriptions 1\n"), std::string::npos) << response;
+    // Gauges, the replies have been written by now
+    EXPECT_NE(response.find("\npubsub_connections 1\n"), std::string::npos) << response;
+    EXPECT_NE(response.find("\npubsub_outbound_queued_frames 0\n"), std::string::npos) << response;
+    EXPECT_NE(response.find("pubsub_stage_duration_seconds_count{stage=\"route\"} 2\n"), std::string::npos)
+        << response;
+    EXPECT_NE(response.find("pubsub_stage_duration_seconds_bucket{stage=\"parse\",le=\"+Inf\"} 4\n"),
+              std::string::npos)
+        << response;
+    EXPECT_NE(response.find("pubsub_topic_messages_total{topic=\"md.aapl\"} 2\n"), std::string::npos) << response;
+
+    EXPECT_EQ(scrape("/").rfind("HTTP/1.1 404 Not Found\r\n", 0), 0u);
+
+    client.disconnect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    io_context.stop();
+    client_io_context.stop();
+
+    if (server_thread.joinable()) {
+        server_thread.join();
+    }
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+}
+
+TEST(MultiThreadedServerTest, DeliversAcrossWorkers) {
+    constexpr int kWorkers = 2;
+    constexpr int kSubscribers = 4;
+
+    // Workers share the topic manager, connections land on either of them
+    auto topic_manager = std::make_shared<pubsub::TopicManager>();
+    std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts;
+    std::vector<std::unique_ptr<pubsub::server::PubSubServer>> servers;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < kWorkers; ++i) {
+        io_contexts.push_back(std::make_unique<boost::asio::io_context>());
+        servers.push_back(std::make_unique<pubsub::server::PubSubServer>(*io_contexts.back(), 12346, topic_manager));
+    }
+    for (auto &io_context : io_contexts) {
+        workers.emplace_back([&io_context]() {
+            io_context->run();
+        });
+    }
+
+    boost::asio::io_context client_io_context;
+    std::thread client_thread([&client_io_context]() {
+        boost::asio::io_context::work work(client_io_context);
+        client_io_context.run();
+    });
+
+    std::vector<std::unique_ptr<MockClient>> subscribers;
+    for (int i = 0; i < kSubscribers; ++i) {
+        subscribers.push_back(std::make_unique<MockClient>(client_io_context));
+        auto &subscriber = *subscribers.back();
+        ASSERT_NO_THROW(subscriber.connect_socket("127.0.0.1", "12346"));
+        ASSERT_NO_THROW(subscriber.connect("subscriber" + std::to_string(i)));
+        ASSERT_NO_THROW(subscriber.subscribe("topic"));
+
+        EXPECT_CALL(subscriber, on_message_received(_, _))
+            .Times(1)
+            .WillOnce([](const std::string &topic, const std::string &message) {
+                EXPECT_EQ(message, "data");
+                EXPECT_EQ(topic, "topic");
+            });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    MockClient publisher(client_io_context);
+    ASSERT_NO_THROW(publisher.connect_socket("127.0.0.1", "12346"));
+    ASSERT_NO_THROW(publisher.connect("publisher"));
+    ASSERT_NO_THROW(publisher.publish("topic", "data"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    for (auto &subscriber : subscribers) {
+        subscriber->disconnect();
+    }
+    publisher.disconnect();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    client_io_context.stop();
+    if (client_thread.joinable()) {
+        client_thread.join();
+    }
+    for (auto &io_context : io_contexts) {
+        io_context->stop();
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+TEST(SharedMemoryServerTest, SlowConsumerDisconnectUnsubscribes) {
+    const std::string path = "/tmp/pubsub_test_slow_" + std::to_string(::getpid()) + ".sock";
+    boost::asio::io_context io_context;
+    pubsub::server::PubSubServer server(io_context, 12347);
+    ASSERT_TRUE(server.listen_local(path));
+    pubsub::OutboundLimits limits;
+    limits.max_frames = 1;
+    limits.policy = pubsub::SlowConsumerPolicy::DISCONNECT;
+    server.topic_manager().set_topic_limits("slow", limits);
+    std::thread server_thread([&io_context]() {
+        io_context.run();
+    });
+
+    boost::asio::io_context subscriber_io_context;
+    boost::asio::io_context publisher_io_context;
+    std::thread subscriber_thread([&subscriber_io_context]() {
+        boost::asio::io_context::work work(subscriber_io_context);
+        subscriber_io_context.run();
+    });
+    std::thread publisher_thread([&publisher_io_context]() {
+        boost::asio::io_context::work work(publisher_io_context);
+        publisher_io_context.run();
+    });
+
+    // Stalls on the first message, so the smallest ring fills up and frames queue on the server
+    MockClient subscriber(subscriber_io_context, pubsub::ProtocolVersion::BINARY);
+    EXPECT_CALL(subscriber, on_message_received(_, _)).WillRepeatedly([](const std::string &, const std::string &) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    });
+    ASSERT_NO_THROW(subscriber.connect_shared_memory(path, {}, pubsub::ShmChannel::kMinRingBytes));
+    ASSERT_NO_THROW(subscriber.connect("subscriber"));
+    ASSERT_NO_THROW(subscriber.subscribe("slow"));
+
+    MockClient publisher(publisher_io_context);
+    ASSERT_NO_THROW(publisher.connect_socket("127.0.0.1", "12347"));
+    ASSERT_NO_THROW(publisher.connect("publisher"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(server.stats().snapshot(server.topic_manager()).subscriptions, 1u);
+
+    const std::string payload(3000, 'x');
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_NO_THROW(publisher.publish("slow", payload));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // The closed subscriber is gone from the routing table and the open connections
+    const auto snapshot = server.stats().snapshot(server.topic_manager());
+    EXPECT_EQ(snapshot.subscriptions, 0u);
+    EXPECT_EQ(snapshot.connections, 1u);
+    EXPECT_EQ(snapshot.slow_consumer_disconnects, 1u);
+
+    publisher.disconnect();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    publisher_io_context.stop();
+    publisher_thread.join();
+    subscriber_io_context.stop();
+    subscriber_thread.join();
+    io_context.stop();
+    server_thread.join();
+}
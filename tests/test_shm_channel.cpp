@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "shm_channel.h"
+
+using namespace pubsub;
+
+namespace {
+
+// Client side of `server`, mapped through a descriptor passed over a socket pair
+std::unique_ptr<ShmChannel> attach(const ShmChannel &server) {
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        return nullptr;
+    }
+    const bool sent = send_descriptor(sockets[0], server.fd());
+    const int fd = sent ? receive_descriptor(sockets[1]) : -1;
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+    return fd >= 0 ? ShmChannel::open(fd) : nullptr;
+}
+
+// Bytes waiting on `fd`, without blocking
+std::size_t pending_bytes(int fd) {
+    char buffer[16];
+    const auto received = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    return received > 0 ? static_cast<std::size_t>(received) : 0;
+}
+
+}  // namespace
+
+TEST(ShmChannelTest, ServerReadsWhatClientWrites) {
+    auto server = ShmChannel::create(ShmChannel::kMinRingBytes);
+    ASSERT_NE(server, nullptr);
+    auto client = attach(*server);
+    ASSERT_NE(client, nullptr);
+
+    EXPECT_EQ(client->outbound().write("PUBLISH a b\n", 12), 12u);
+    char buffer[32];
+    ASSERT_EQ(server->inbound().read(buffer, sizeof(buffer)), 12u);
+    EXPECT_EQ(std::string(buffer, 12), "PUBLISH a b\n");
+    EXPECT_FALSE(server->inbound().readable());
+
+    EXPECT_EQ(server->outbound().write("ok", 2), 2u);
+    ASSERT_EQ(client->inbound().read(buffer, sizeof(buffer)), 2u);
+    EXPECT_EQ(std::string(buffer, 2), "ok");
+}
+
+TEST(ShmChannelTest, WritesStopWhenFullAndWrapAround) {
+    auto server = ShmChannel::create(1);
+    ASSERT_NE(server, nullptr);
+    auto client = attach(*server);
+    ASSERT_NE(client, nullptr);
+    auto &ring = client->outbound();
+    ASSERT_EQ(ring.capacity(), ShmChannel::kMinRingBytes);
+
+    const std::string fill(ring.capacity() - 10, 'x');
+    EXPECT_EQ(ring.write(fill.data(), fill.size()), fill.size());
+    std::string out(ring.capacity(), '\0');
+    EXPECT_EQ(server->inbound().read(out.data(), 100), 100u);
+
+    // Starts 10 bytes before the end of the ring and continues at its front
+    EXPECT_EQ(ring.write("0123456789abcdef", 16), 16u);
+    // Only part of the next write fits
+    EXPECT_EQ(ring.write(fill.data(), fill.size()), 94u);
+    EXPECT_FALSE(ring.writable());
+
+    EXPECT_EQ(server->inbound().read(out.data(), fill.size() - 100), fill.size() - 100);
+    ASSERT_EQ(server->inbound().read(out.data(), 16), 16u);
+    EXPECT_EQ(out.substr(0, 16), "0123456789abcdef");
+}
+
+TEST(ShmChannelTest, DoorbellOnlyWhenPeerParked) {
+    int sockets[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    auto server = ShmChannel::create(ShmChannel::kMinRingBytes);
+    ASSERT_NE(server, nullptr);
+    auto client = attach(*server);
+    ASSERT_NE(client, nullptr);
+
+    // Busy server, no doorbell
+    client->outbound().write("a", 1);
+    client->notify_peer(sockets[0]);
+    EXPECT_EQ(pending_bytes(sockets[1]), 0u);
+
+    // Work is waiting, the server does not park
+    EXPECT_FALSE(server->park(false));
+    char byte;
+    server->inbound().read(&byte, 1);
+    EXPECT_TRUE(server->park(false));
+
+    client->outbound().write("b", 1);
+    client->notify_peer(sockets[0]);
+    client->notify_peer(sockets[0]);
+    EXPECT_EQ(pending_bytes(sockets[1]), 1u);
+
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+}
+
+TEST(ShmChannelTest, ClientCanNotResizeSegment) {
+    auto server = ShmChannel::create(ShmChannel::kMinRingBytes);
+    ASSERT_NE(server, nullptr);
+    struct stat before {};
+    ASSERT_EQ(::fstat(server->fd(), &before), 0);
+
+    // What a client could try through its copy of the descriptor
+    EXPECT_NE(::ftruncate(server->fd(), 0), 0);
+    EXPECT_NE(::ftruncate(server->fd(), before.st_size * 2), 0);
+    EXPECT_NE(::fcntl(server->fd(), F_ADD_SEALS, 0), 0);
+    struct stat after {};
+    ASSERT_EQ(::fstat(server->fd(), &after), 0);
+    EXPECT_EQ(after.st_size, before.st_size);
+}
+
+TEST(ShmChannelTest, RejectsInvalidSegments) {
+    // Too small for the header
+    const int fd = ::memfd_create("pubsub-test", MFD_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(ShmChannel::open(fd), nullptr);
+
+    // A byte without a descriptor
+    int sockets[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    ASSERT_EQ(::write(sockets[0], "x", 1), 1);
+    EXPECT_EQ(receive_descriptor(sockets[1]), -1);
+    ::close(sockets[0]);
+    ::close(sockets[1]);
+}
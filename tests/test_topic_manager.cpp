@@ -0,0 +1,624 @@
+#include <gtest/gtest.h>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include "topic_manager.h"
+
+using namespace pubsub;
+
+class TopicManagerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        acceptor.open(boost::asio::ip::tcp::v4());
+        acceptor.bind(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+        acceptor.listen();
+    }
+
+    // Connected pair: the server side Connection and the raw client socket
+    std::shared_ptr<Connection> connect(boost::asio::ip::tcp::socket &client) {
+        client.connect(acceptor.local_endpoint());
+        boost::asio::ip::tcp::socket server_side(io_context);
+        acceptor.accept(server_side);
+        return std::make_shared<Connection>(std::move(server_side));
+    }
+
+    // Let queued writes complete, then read whatever reached the client
+    std::string drain(boost::asio::ip::tcp::socket &client) {
+        std::string received;
+        for (int i = 0; i < 20; ++i) {
+            io_context.poll();
+            while (client.available() > 0) {
+                std::string chunk(client.available(), '\0');
+                client.read_some(boost::asio::buffer(chunk));
+                received += chunk;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return received;
+    }
+
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::acceptor acceptor{io_context};
+};
+
+TEST_F(TopicManagerTest, PublishReachesEverySubscriber) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client1(io_context);
+    boost::asio::ip::tcp::socket client2(io_context);
+    auto connection1 = connect(client1);
+    auto connection2 = connect(client2);
+
+    manager.subscribe("topic", connection1);
+    manager.subscribe("topic", connection2);
+    manager.publish("topic", "data");
+
+    EXPECT_EQ(drain(client1), "PUBLISH topic data\n");
+    EXPECT_EQ(drain(client2), "PUBLISH topic data\n");
+}
+
+TEST_F(TopicManagerTest, PublishOnlyReachesItsTopic) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("topic1", connection);
+    manager.publish("topic2", "data");
+
+    EXPECT_EQ(drain(client), "");
+}
+
+TEST_F(TopicManagerTest, InternReturnsStableIds) {
+    TopicManager manager(4);
+    const auto id1 = manager.intern("topic1");
+    const auto id2 = manager.intern("topic2");
+
+    EXPECT_NE(id1, id2);
+    EXPECT_EQ(manager.intern("topic1"), id1);
+
+    // Interned ids survive the topic losing all of its subscribers
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+    manager.subscribe("topic1", connection);
+    manager.unsubscribe_all(connection);
+    EXPECT_EQ(manager.intern("topic1"), id1);
+}
+
+TEST_F(TopicManagerTest, ReusesSlotsOfReleasedTopics) {
+    TopicManager manager(1);
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    // Pinned twice, and subscribed
+    const auto id = manager.intern("old");
+    manager.intern("old");
+    manager.subscribe("old", connection);
+    manager.release(id);
+    manager.unsubscribe("old", connection);
+    manager.release(id);
+    EXPECT_EQ(manager.intern("new"), id);
+
+    // Released ids no longer publish
+    manager.subscribe("old", connection);
+    manager.release(id);
+    manager.publish(id, "stale");
+    manager.publish("old", "live");
+    EXPECT_EQ(drain(client), "PUBLISH old live\n");
+
+    // Neither do topics with limits
+    manager.set_topic_limits("limited", OutboundLimits{});
+    manager.release(manager.intern("limited"));
+    EXPECT_NE(manager.intern("other"), manager.intern("limited"));
+}
+
+TEST_F(TopicManagerTest, PublishById) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    const auto id = manager.intern("topic");
+    manager.subscribe("topic", connection);
+    manager.publish(id, "data");
+    // Unknown ids are ignored
+    manager.publish(id + 1000000, "data");
+
+    EXPECT_EQ(drain(client), "PUBLISH topic data\n");
+}
+
+TEST_F(TopicManagerTest, PublishByIdReachesWildcards) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("sensors.*", connection);
+    manager.publish(manager.intern("sensors.temp"), "21");
+
+    EXPECT_EQ(drain(client), "PUBLISH sensors.temp 21\n");
+}
+
+TEST_F(TopicManagerTest, EncodesPerProtocol) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+    connection->set_protocol(ProtocolVersion::BINARY);
+
+    manager.subscribe("topic", connection);
+    manager.publish("topic", "data");
+
+    Message expected;
+    expected.type = MessageType::PUBLISH;
+    expected.topic = "topic";
+    expected.data = "data";
+    EXPECT_EQ(drain(client), expected.serialize(ProtocolVersion::BINARY));
+}
+
+TEST_F(TopicManagerTest, CompressesOnceForSubscribersThatAcceptIt) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client1(io_context);
+    boost::asio::ip::tcp::socket client2(io_context);
+    boost::asio::ip::tcp::socket client3(io_context);
+    auto connection1 = connect(client1);
+    auto connection2 = connect(client2);
+    auto connection3 = connect(client3);
+    for (const auto &connection : {connection1, connection2, connection3}) {
+        connection->set_protocol(ProtocolVersion::BINARY);
+        manager.subscribe("topic", connection);
+    }
+    connection1->set_compression(true);
+    connection2->set_compression(true);
+
+    const std::string payload(compression::kDefaultThreshold, 'x');
+    manager.publish("topic", payload);
+
+    const auto received1 = drain(client1);
+    EXPECT_EQ(drain(client2), received1);
+    const auto parsed = Message::deserialize(received1, ProtocolVersion::BINARY);
+    ASSERT_TRUE(parsed.compressed);
+    std::string inflated;
+    ASSERT_TRUE(compression::decompress(parsed.data, inflated));
+    EXPECT_EQ(inflated, payload);
+
+    Message expected;
+    expected.type = MessageType::PUBLISH;
+    expected.topic = "topic";
+    expected.data = payload;
+    EXPECT_EQ(drain(client3), expected.serialize(ProtocolVersion::BINARY));
+
+    // Below the threshold everybody gets the payload as it is
+    manager.publish("topic", "small");
+    expected.data = "small";
+    EXPECT_EQ(drain(client1), expected.serialize(ProtocolVersion::BINARY));
+}
+
+TEST_F(TopicManagerTest, UnsubscribeStopsDelivery) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("topic", connection);
+    manager.unsubscribe("topic", connection);
+    manager.publish("topic", "data");
+
+    EXPECT_EQ(drain(client), "");
+}
+
+TEST_F(TopicManagerTest, UnsubscribeAllOnlyRemovesThatConnection) {
+    TopicManager manager(4);
+    boost::asio::ip::tcp::socket client1(io_context);
+    boost::asio::ip::tcp::socket client2(io_context);
+    auto connection1 = connect(client1);
+    auto connection2 = connect(client2);
+
+    for (int i = 0; i < 16; ++i) {
+        manager.subscribe("topic" + std::to_string(i), connection1);
+    }
+    manager.subscribe("topic0", connection2);
+    manager.unsubscribe_all(connection1);
+
+    for (int i = 0; i < 16; ++i) {
+        manager.publish("topic" + std::to_string(i), "data");
+    }
+
+    EXPECT_EQ(drain(client1), "");
+    EXPECT_EQ(drain(client2), "PUBLISH topic0 data\n");
+}
+
+TEST_F(TopicManagerTest, ConcurrentPublishersDeliverEverything) {
+    constexpr int kThreads = 4;
+    constexpr int kMessages = 250;
+
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+    for (int t = 0; t < kThreads; ++t) {
+        manager.subscribe("topic" + std::to_string(t), connection);
+    }
+
+    // Publishers run on other threads, their frames are posted to io_context
+    std::vector<std::thread> publishers;
+    for (int t = 0; t < kThreads; ++t) {
+        publishers.emplace_back([&manager, t]() {
+            for (int i = 0; i < kMessages; ++i) {
+                manager.publish("topic" + std::to_string(t), "x");
+            }
+        });
+    }
+    for (auto &publisher : publishers) {
+        publisher.join();
+    }
+
+    const std::string received = drain(client);
+    EXPECT_EQ(std::count(received.begin(), received.end(), '\n'), kThreads * kMessages);
+}
+
+TEST_F(TopicManagerTest, ResubscribeAfterUnsubscribeAll) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("topic1", connection);
+    manager.subscribe("topic2", connection);
+    manager.unsubscribe("topic1", connection);
+    manager.unsubscribe_all(connection);
+    manager.subscribe("topic1", connection);
+
+    manager.publish("topic1", "data");
+    manager.publish("topic2", "data");
+
+    EXPECT_EQ(drain(client), "PUBLISH topic1 data\n");
+}
+
+TEST_F(TopicManagerTest, SingleLevelWildcardMatchesOneLevel) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("md.equities.*", connection);
+    manager.publish("md.equities.aapl", "1");
+    manager.publish("md.equities.aapl.bid", "2");
+    manager.publish("md.equities", "3");
+    manager.publish("md.futures.es", "4");
+
+    EXPECT_EQ(drain(client), "PUBLISH md.equities.aapl 1\n");
+}
+
+TEST_F(TopicManagerTest, MultiLevelWildcardMatchesAnyDepth) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("md.#", connection);
+    manager.publish("md", "1");
+    manager.publish("md.equities.aapl.bid", "2");
+    manager.publish("ref.equities", "3");
+
+    EXPECT_EQ(drain(client), "PUBLISH md 1\nPUBLISH md.equities.aapl.bid 2\n");
+}
+
+TEST_F(TopicManagerTest, OverlappingSubscriptionsDeliverOnce) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("md.equities.aapl", connection);
+    manager.subscribe("md.*.aapl", connection);
+    manager.subscribe("md.#", connection);
+    manager.publish("md.equities.aapl", "data");
+
+    EXPECT_EQ(drain(client), "PUBLISH md.equities.aapl data\n");
+}
+
+TEST_F(TopicManagerTest, WildcardUnsubscribe) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client1(io_context);
+    boost::asio::ip::tcp::socket client2(io_context);
+    auto connection1 = connect(client1);
+    auto connection2 = connect(client2);
+
+    manager.subscribe("md.*", connection1);
+    manager.subscribe("md.#", connection1);
+    manager.subscribe("md.*", connection2);
+    manager.unsubscribe("md.*", connection1);
+    manager.unsubscribe_all(connection2);
+    manager.publish("md.aapl", "data");
+
+    EXPECT_EQ(drain(client1), "PUBLISH md.aapl data\n");
+    EXPECT_EQ(drain(client2), "");
+}
+
+// Publishes from this thread are only enqueued once the io_context runs, so
+// every frame after the first is still queued when the limits are checked
+TEST_F(TopicManagerTest, SlowConsumerDropNewest) {
+    TopicManager manager;
+    manager.set_default_limits(OutboundLimits{1024, 3, SlowConsumerPolicy::DROP_NEWEST});
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("topic", connection);
+    for (int i = 0; i < 10; ++i) {
+        manager.publish("topic", std::to_string(i));
+    }
+
+    EXPECT_EQ(drain(client), "PUBLISH topic 0\nPUBLISH topic 1\nPUBLISH topic 2\n");
+    EXPECT_EQ(manager.slow_consumer_counters().dropped_newest, 7u);
+    EXPECT_EQ(connection->queued_bytes(), 0u);
+}
+
+TEST_F(TopicManagerTest, SlowConsumerDropOldest) {
+    TopicManager manager;
+    manager.set_default_limits(OutboundLimits{1024, 3, SlowConsumerPolicy::DROP_OLDEST});
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("topic", connection);
+    for (int i = 0; i < 10; ++i) {
+        manager.publish("topic", std::to_string(i));
+    }
+
+    // The first frame was already being written and can not be dropped
+    EXPECT_EQ(drain(client), "PUBLISH topic 0\nPUBLISH topic 8\nPUBLISH topic 9\n");
+    EXPECT_EQ(manager.slow_consumer_counters().dropped_oldest, 7u);
+}
+
+TEST_F(TopicManagerTest, SlowConsumerByteLimit) {
+    TopicManager manager;
+    // Room for two frames of "PUBLISH topic 0\n"
+    manager.set_default_limits(OutboundLimits{32, 100, SlowConsumerPolicy::DROP_NEWEST});
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.subscribe("topic", connection);
+    for (int i = 0; i < 5; ++i) {
+        manager.publish("topic", std::to_string(i));
+    }
+
+    EXPECT_EQ(drain(client), "PUBLISH topic 0\nPUBLISH topic 1\n");
+    EXPECT_EQ(manager.slow_consumer_counters().dropped_newest, 3u);
+}
+
+TEST_F(TopicManagerTest, SlowConsumerTopicOverrideDisconnects) {
+    TopicManager manager;
+    manager.set_default_limits(OutboundLimits{1024, 3, SlowConsumerPolicy::DROP_NEWEST});
+    manager.set_topic_limits("urgent", OutboundLimits{1024, 3, SlowConsumerPolicy::DISCONNECT});
+    boost::asio::ip::tcp::socket client1(io_context);
+    boost::asio::ip::tcp::socket client2(io_context);
+    auto lagging = connect(client1);
+    auto other = connect(client2);
+
+    manager.subscribe("urgent", lagging);
+    manager.subscribe("other", other);
+    for (int i = 0; i < 10; ++i) {
+        manager.publish("urgent", std::to_string(i));
+        manager.publish("other", std::to_string(i));
+    }
+    drain(client1);
+    drain(client2);
+
+    EXPECT_FALSE(lagging->is_open());
+    EXPECT_TRUE(other->is_open());
+    EXPECT_EQ(manager.slow_consumer_counters().disconnects, 1u);
+    EXPECT_EQ(manager.slow_consumer_counters().dropped_newest, 7u);
+}
+
+TEST_F(TopicManagerTest, SubscribeReplaysLogThenLive) {
+    const auto directory = std::filesystem::temp_directory_path() / "pubsub_topic_manager_replay";
+    std::filesystem::remove_all(directory);
+    {
+        MessageLog message_log(MessageLog::Options{directory});
+        TopicManager manager;
+        ASSERT_TRUE(manager.enable_log("topic", message_log));
+        boost::asio::ip::tcp::socket client(io_context);
+        auto connection = connect(client);
+
+        // Logged without any subscriber
+        manager.publish("topic", "0");
+        manager.publish("topic", "1");
+        manager.publish("topic", "2");
+
+        manager.subscribe("topic", connection, 1);
+        manager.publish("topic", "3");
+
+        EXPECT_EQ(drain(client), "PUBLISH topic 1\nPUBLISH topic 2\nPUBLISH topic 3\n");
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(TopicManagerTest, ReplayIsPacedByTheOutboundQueue) {
+    const auto directory = std::filesystem::temp_directory_path() / "pubsub_topic_manager_paced_replay";
+    std::filesystem::remove_all(directory);
+    {
+        MessageLog message_log(MessageLog::Options{directory});
+        TopicManager manager;
+        // A queue far smaller than the history
+        manager.set_default_limits(OutboundLimits{16 * 1024 * 1024, 64, SlowConsumerPolicy::DROP_NEWEST});
+        ASSERT_TRUE(manager.enable_log("topic", message_log));
+        boost::asio::ip::tcp::socket client(io_context);
+        auto connection = connect(client);
+        connection->set_protocol(ProtocolVersion::BINARY);
+
+        constexpr std::uint64_t kHistory = 5000;
+        constexpr std::uint64_t kTotal = 5200;
+        for (std::uint64_t i = 0; i < kHistory; ++i) {
+            manager.publish("topic", std::to_string(i));
+        }
+        manager.subscribe("topic", connection, 0);
+
+        std::string received;
+        std::vector<std::pair<std::uint64_t, std::string>> messages;
+        std::uint64_t published = kHistory;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+        while (messages.size() < kTotal && std::chrono::steady_clock::now() < deadline) {
+            // Live publishes while the subscriber is catching up, and after
+            if (published < kTotal && messages.size() >= (published - kHistory) * 20) {
+                manager.publish("topic", std::to_string(published++));
+            }
+            io_context.poll();
+            while (client.available() > 0) {
+                std::string chunk(client.available(), '\0');
+                client.read_some(boost::asio::buffer(chunk));
+                received += chunk;
+            }
+            std::string_view pending(received);
+            std::string_view frame;
+            while (std::size_t size = Message::next_frame(pending, ProtocolVersion::BINARY, frame)) {
+                const auto msg = MessageView::parse(frame, ProtocolVersion::BINARY);
+                messages.emplace_back(msg.offset, std::string(msg.data));
+                pending.remove_prefix(size);
+            }
+            received.erase(0, received.size() - pending.size());
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        ASSERT_EQ(messages.size(), kTotal);
+        for (std::uint64_t i = 0; i < kTotal; ++i) {
+            ASSERT_EQ(messages[i], std::make_pair(i, std::to_string(i)));
+        }
+        EXPECT_EQ(manager.slow_consumer_counters().dropped_newest, 0u);
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(TopicManagerTest, BinarySubscribersSeeLogOffsets) {
+    const auto directory = std::filesystem::temp_directory_path() / "pubsub_topic_manager_offsets";
+    std::filesystem::remove_all(directory);
+    {
+        MessageLog message_log(MessageLog::Options{directory});
+        TopicManager manager;
+        ASSERT_TRUE(manager.enable_log("topic", message_log));
+        boost::asio::ip::tcp::socket client(io_context);
+        auto connection = connect(client);
+        connection->set_protocol(ProtocolVersion::BINARY);
+
+        manager.publish("topic", "replayed");
+        manager.subscribe("topic", connection, 0);
+        manager.publish("topic", "live");
+
+        const std::string received = drain(client);
+        std::string_view pending(received);
+        std::string_view frame;
+        std::vector<std::pair<std::uint64_t, std::string>> messages;
+        while (std::size_t size = Message::next_frame(pending, ProtocolVersion::BINARY, frame)) {
+            const auto msg = MessageView::parse(frame, ProtocolVersion::BINARY);
+            messages.emplace_back(msg.offset, std::string(msg.data));
+            pending.remove_prefix(size);
+        }
+
+        ASSERT_EQ(messages.size(), 2u);
+        EXPECT_EQ(messages[0], std::make_pair(std::uint64_t{0}, std::string("replayed")));
+        EXPECT_EQ(messages[1], std::make_pair(std::uint64_t{1}, std::string("live")));
+    }
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(TopicManagerTest, SubscribeGetsRetainedValue) {
+    TopicManager manager;
+    manager.set_retained_budget(64 * 1024);
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.publish("ref.fx", "1.08");
+    manager.publish("ref.fx", "1.09");
+    manager.subscribe("ref.fx", connection);
+    manager.publish("ref.fx", "1.10");
+    // Already subscribed, the retained value is not sent again
+    manager.subscribe("ref.fx", connection);
+
+    EXPECT_EQ(drain(client), "PUBLISH ref.fx 1.09\nPUBLISH ref.fx 1.10\n");
+}
+
+TEST_F(TopicManagerTest, WildcardSubscribeGetsMatchingRetainedValues) {
+    TopicManager manager;
+    manager.set_retained_budget(64 * 1024);
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.publish("ref.fx.eur", "1.09");
+    manager.publish("ref.rates", "4.5");
+    manager.publish("md.aapl", "190");
+    manager.subscribe("ref.#", connection);
+    manager.subscribe("ref.#", connection);
+
+    std::string received = drain(client);
+    EXPECT_EQ(received.size(), std::string("PUBLISH ref.fx.eur 1.09\nPUBLISH ref.rates 4.5\n").size()) << received;
+    EXPECT_NE(received.find("PUBLISH ref.fx.eur 1.09\n"), std::string::npos);
+    EXPECT_NE(received.find("PUBLISH ref.rates 4.5\n"), std::string::npos);
+    EXPECT_EQ(received.find("md.aapl"), std::string::npos);
+}
+
+TEST_F(TopicManagerTest, RetainedValuesEvictLeastRecentlyUsed) {
+    // Room for two values of 6 bytes
+    TopicManager manager;
+    manager.set_retained_budget(12);
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.publish("t1", "aaaa");
+    manager.publish("t2", "bbbb");
+    manager.publish("t1", "cccc");
+    // Evicts t2, the least recently used
+    manager.publish("t3", "dddd");
+    // Does not fit at all
+    manager.publish("t4", std::string(16, 'e'));
+
+    manager.subscribe("t1", connection);
+    manager.subscribe("t2", connection);
+    manager.subscribe("t3", connection);
+    manager.subscribe("t4", connection);
+
+    EXPECT_EQ(drain(client), "PUBLISH t1 cccc\nPUBLISH t3 dddd\n");
+}
+
+TEST_F(TopicManagerTest, RetainsValuesLargerThanShardShareOfBudget) {
+    // The budget is not split between the shards, one value may take all of it
+    TopicManager manager(64);
+    manager.set_retained_budget(64 * 1024);
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    const std::string snapshot(32 * 1024, 's');
+    manager.publish("book", snapshot);
+    manager.publish("small", "1");
+    manager.subscribe("book", connection);
+    manager.subscribe("small", connection);
+
+    EXPECT_EQ(drain(client), "PUBLISH book " + snapshot + "\nPUBLISH small 1\n");
+}
+
+TEST_F(TopicManagerTest, NothingRetainedByDefault) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client(io_context);
+    auto connection = connect(client);
+
+    manager.publish("topic", "data");
+    manager.subscribe("topic", connection);
+
+    EXPECT_EQ(drain(client), "");
+}
+
+TEST_F(TopicManagerTest, StatsCountTopicsAndSubscriptions) {
+    TopicManager manager;
+    boost::asio::ip::tcp::socket client1(io_context);
+    boost::asio::ip::tcp::socket client2(io_context);
+    auto connection1 = connect(client1);
+    auto connection2 = connect(client2);
+
+    manager.subscribe("a", connection1);
+    manager.subscribe("a", connection2);
+    manager.subscribe("b", connection1);
+    manager.subscribe("md.#", connection2);
+    manager.publish("nobody", "data");
+    manager.publish("a", "data");
+
+    StatsSnapshot snapshot;
+    manager.add_stats(snapshot);
+    EXPECT_EQ(snapshot.topics, 2u);
+    EXPECT_EQ(snapshot.subscriptions, 4u);
+    EXPECT_EQ(snapshot.unrouted_publishes, 1u);
+
+    manager.unsubscribe_all(connection1);
+    snapshot = StatsSnapshot();
+    manager.add_stats(snapshot);
+    EXPECT_EQ(snapshot.topics, 1u);
+    EXPECT_EQ(snapshot.subscriptions, 2u);
+}